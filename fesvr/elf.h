@@ -29,6 +29,12 @@
 
 #define SHT_NOBITS 8
 
+#define SHN_UNDEF 0
+
+#define STT_NOTYPE 0
+#define STT_FUNC 2
+#define ELF_ST_TYPE(info) ((info) & 0xf)
+
 typedef struct {
   uint8_t  e_ident[16];
   uint16_t e_type;
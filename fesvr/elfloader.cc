@@ -2,6 +2,7 @@
 
 #include "elf.h"
 #include "memif.h"
+#include "elfloader.h"
 #include "byteorder.h"
 #include <cstring>
 #include <string>
@@ -16,7 +17,8 @@
 #include <vector>
 #include <map>
 
-std::map<std::string, uint64_t> load_elf(const char* fn, memif_t* memif, reg_t* entry)
+std::map<std::string, uint64_t> load_elf(const char* fn, memif_t* memif, reg_t* entry,
+                                         std::vector<elf_function_t>* functions)
 {
   int fd = open(fn, O_RDONLY);
   struct stat s;
@@ -89,6 +91,13 @@ std::map<std::string, uint64_t> load_elf(const char* fn, memif_t* memif, reg_t*
         assert(bswap(sym[i].st_name) < bswap(sh[strtabidx].sh_size));          \
         assert(strnlen(strtab + bswap(sym[i].st_name), max_len) < max_len);    \
         symbols[strtab + bswap(sym[i].st_name)] = bswap(sym[i].st_value);      \
+        unsigned type = ELF_ST_TYPE(sym[i].st_info);                           \
+        if (functions && bswap(sym[i].st_shndx) != SHN_UNDEF &&                \
+            (type == STT_FUNC || type == STT_NOTYPE) &&                        \
+            strtab[bswap(sym[i].st_name)] != '\0')                             \
+          functions->push_back({strtab + bswap(sym[i].st_name),                \
+                                bswap(sym[i].st_value),                        \
+                                bswap(sym[i].st_size)});                       \
       }                                                                        \
     }                                                                          \
   } while (0)
@@ -6,8 +6,20 @@
 #include "elf.h"
 #include <map>
 #include <string>
+#include <vector>
+
+// a code symbol and the number of bytes it covers, which is 0 if the ELF
+// does not say
+struct elf_function_t {
+  std::string name;
+  uint64_t addr;
+  uint64_t size;
+};
 
 class memif_t;
-std::map<std::string, uint64_t> load_elf(const char* fn, memif_t* memif, reg_t* entry);
+// if functions is given, the function and untyped symbols that are defined
+// are appended to it
+std::map<std::string, uint64_t> load_elf(const char* fn, memif_t* memif, reg_t* entry,
+                                         std::vector<elf_function_t>* functions = NULL);
 
 #endif
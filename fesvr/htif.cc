@@ -95,7 +95,8 @@ static void bad_address(const std::string& situation, reg_t addr)
   exit(-1);
 }
 
-std::map<std::string, uint64_t> htif_t::load_payload(const std::string& payload, reg_t* entry)
+std::map<std::string, uint64_t> htif_t::load_payload(const std::string& payload, reg_t* entry,
+                                                     std::vector<elf_function_t>* functions)
 {
   std::string path;
   if (access(payload.c_str(), F_OK) == 0)
@@ -129,7 +130,7 @@ std::map<std::string, uint64_t> htif_t::load_payload(const std::string& payload,
   } preload_aware_memif(this);
 
   try {
-    return load_elf(path.c_str(), &preload_aware_memif, entry);
+    return load_elf(path.c_str(), &preload_aware_memif, entry, functions);
   } catch (mem_trap_t& t) {
     bad_address("loading payload " + payload, t.get_tval());
     abort();
@@ -138,7 +139,8 @@ std::map<std::string, uint64_t> htif_t::load_payload(const std::string& payload,
 
 void htif_t::load_program()
 {
-  std::map<std::string, uint64_t> symbols = load_payload(targs[0], &entry);
+  std::vector<elf_function_t> function_symbols;
+  std::map<std::string, uint64_t> symbols = load_payload(targs[0], &entry, &function_symbols);
 
   if (symbols.count("tohost") && symbols.count("fromhost")) {
     tohost_addr = symbols["tohost"];
@@ -157,7 +159,7 @@ void htif_t::load_program()
   for (auto payload : payloads)
   {
     reg_t dummy_entry;
-    load_payload(payload, &dummy_entry);
+    load_payload(payload, &dummy_entry, &function_symbols);
   }
 
    for (auto i : symbols)
@@ -167,7 +169,47 @@ void htif_t::load_program()
        addr2symbol[i.second] = i.first;
    }
 
-   return;
+   set_functions(function_symbols);
+}
+
+void htif_t::set_functions(std::vector<elf_function_t> symbols)
+{
+  // symbols at the same address are aliases; the sized one, else the
+  // first, names the function
+  std::stable_sort(symbols.begin(), symbols.end(),
+                   [](const elf_function_t& a, const elf_function_t& b) {
+    return a.addr != b.addr ? a.addr < b.addr : a.size > b.size;
+  });
+
+  // a sized symbol covers its bytes, unless an earlier one already does
+  std::vector<elf_function_t> sized;
+  for (auto& sym : symbols) {
+    if (sym.size && (sized.empty() || sym.addr >= sized.back().addr + sized.back().size))
+      sized.push_back(sym);
+  }
+
+  // an unsized symbol, e.g. an assembly label, covers the bytes up to the
+  // next symbol that are not in a sized one
+  functions.clear();
+  auto next_sized = sized.begin();
+  for (size_t i = 0; i < symbols.size(); i++) {
+    const elf_function_t& sym = symbols[i];
+    while (next_sized != sized.end() && next_sized->addr + next_sized->size <= sym.addr)
+      functions.push_back(*next_sized++);
+    if (sym.size || (i > 0 && symbols[i - 1].addr == sym.addr) ||
+        (next_sized != sized.end() && next_sized->addr <= sym.addr))
+      continue;
+
+    uint64_t end = UINT64_MAX;
+    for (size_t j = i + 1; j < symbols.size(); j++) {
+      if (symbols[j].addr != sym.addr) {
+        end = symbols[j].addr;
+        break;
+      }
+    }
+    functions.push_back({sym.name, sym.addr, end - sym.addr});
+  }
+  functions.insert(functions.end(), next_sized, sized.end());
 }
 
 const char* htif_t::get_symbol(uint64_t addr)
@@ -180,6 +222,23 @@ const char* htif_t::get_symbol(uint64_t addr)
   return it->second.c_str();
 }
 
+const char* htif_t::get_function(uint64_t addr)
+{
+  auto it = std::upper_bound(functions.begin(), functions.end(), addr,
+                             [](uint64_t addr, const elf_function_t& f) {
+    return addr < f.addr;
+  });
+
+  if (it == functions.begin())
+    return nullptr;
+
+  --it;
+  if (addr - it->addr >= it->size)
+    return nullptr;
+
+  return it->name.c_str();
+}
+
 void htif_t::stop()
 {
   if (!sig_file.empty() && sig_len) // print final torture test signature
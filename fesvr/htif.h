@@ -7,6 +7,7 @@
 #include "syscall.h"
 #include "device.h"
 #include "byteorder.h"
+#include "elfloader.h"
 #include <string.h>
 #include <map>
 #include <vector>
@@ -55,7 +56,8 @@ class htif_t : public chunked_memif_t
   virtual size_t chunk_align() = 0;
   virtual size_t chunk_max_size() = 0;
 
-  virtual std::map<std::string, uint64_t> load_payload(const std::string& payload, reg_t* entry);
+  virtual std::map<std::string, uint64_t> load_payload(const std::string& payload, reg_t* entry,
+                                                       std::vector<elf_function_t>* functions = NULL);
   virtual void load_program();
   virtual void idle() {}
 
@@ -69,6 +71,8 @@ class htif_t : public chunked_memif_t
 
   // Given an address, return symbol from addr2symbol map
   const char* get_symbol(uint64_t addr);
+  // Given an address, return the function it lies in, or NULL
+  const char* get_function(uint64_t addr);
 
  private:
   void parse_arguments(int argc, char ** argv);
@@ -98,6 +102,8 @@ class htif_t : public chunked_memif_t
   const std::vector<std::string>& target_args() { return targs; }
 
   std::map<uint64_t, std::string> addr2symbol;
+  std::vector<elf_function_t> functions; // by address, not overlapping
+  void set_functions(std::vector<elf_function_t> symbols);
 
   friend class memif_t;
   friend class syscall_t;
@@ -0,0 +1,183 @@
+// See LICENSE for license details.
+
+#include "async_memtracer.h"
+#include <pthread.h>
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+#include <mutex>
+
+// the async_memtracer_t that exist, for the fork handlers
+static std::mutex instances_lock;
+static std::vector<async_memtracer_t*> instances;
+
+async_memtracer_hart_t::async_memtracer_hart_t(async_memtracer_t* owner)
+  : owner(owner), slots(SLOTS), head(0), tail(0)
+{
+}
+
+bool async_memtracer_hart_t::interested_in_range(uint64_t begin, uint64_t end, access_type type)
+{
+  // the tracers only change while the harts are stopped
+  return owner->tracers.interested_in_range(begin, end, type);
+}
+
+void async_memtracer_hart_t::trace(uint64_t addr, size_t bytes, access_type type)
+{
+  uint32_t size = bytes;
+  uint8_t type_byte = type;
+  uint32_t hart = 0;
+  uint64_t pc = 0;
+  trace_batch({1, &addr, &size, &type_byte, &hart, &pc});
+}
+
+void async_memtracer_hart_t::trace_batch(const memtrace_batch_t& batch)
+{
+  for (size_t done = 0; done < batch.size; ) {
+    size_t n = std::min(batch.size - done, SLOT_SIZE);
+    slot_t& slot = acquire();
+    slot.size = n;
+    memcpy(slot.addrs, batch.addrs + done, n * sizeof(*slot.addrs));
+    memcpy(slot.sizes, batch.bytes + done, n * sizeof(*slot.sizes));
+    memcpy(slot.types, batch.types + done, n * sizeof(*slot.types));
+    memcpy(slot.harts, batch.harts + done, n * sizeof(*slot.harts));
+    memcpy(slot.pcs, batch.pcs + done, n * sizeof(*slot.pcs));
+    publish(slot);
+    done += n;
+  }
+}
+
+void async_memtracer_hart_t::clean_invalidate(uint64_t addr, size_t bytes, bool clean, bool inval)
+{
+  slot_t& slot = acquire();
+  slot.size = 0;
+  slot.addr = addr;
+  slot.bytes = bytes;
+  slot.clean = clean;
+  slot.inval = inval;
+  publish(slot);
+}
+
+async_memtracer_hart_t::slot_t& async_memtracer_hart_t::acquire()
+{
+  uint64_t h = head.load(std::memory_order_relaxed);
+  while (h - tail.load(std::memory_order_acquire) == SLOTS)
+    std::this_thread::yield();
+  return slots[h % SLOTS];
+}
+
+void async_memtracer_hart_t::publish(slot_t& slot)
+{
+  // a slot is numbered once it is sure to be published, so the thread never
+  // waits for a number a hart cannot publish
+  slot.seq = owner->next_seq.fetch_add(1, std::memory_order_relaxed);
+  head.store(head.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+}
+
+async_memtracer_t::async_memtracer_t(size_t nharts)
+  : next_seq(0), traced(0), stopping(false)
+{
+  for (size_t i = 0; i < nharts; i++)
+    harts.emplace_back(new async_memtracer_hart_t(this));
+
+  static std::once_flag fork_handlers;
+  std::call_once(fork_handlers, [] {
+    pthread_atfork(before_fork, after_fork, after_fork);
+  });
+
+  std::lock_guard<std::mutex> guard(instances_lock);
+  instances.push_back(this);
+  start();
+}
+
+async_memtracer_t::~async_memtracer_t()
+{
+  std::lock_guard<std::mutex> guard(instances_lock);
+  instances.erase(std::find(instances.begin(), instances.end(), this));
+  stop();
+}
+
+void async_memtracer_t::hook(memtracer_t* tracer)
+{
+  drain();
+  tracers.hook(tracer);
+}
+
+void async_memtracer_t::unhook(memtracer_t* tracer)
+{
+  drain();
+  tracers.unhook(tracer);
+}
+
+void async_memtracer_t::drain()
+{
+  while (traced.load(std::memory_order_acquire) != next_seq.load(std::memory_order_relaxed))
+    std::this_thread::yield();
+}
+
+void async_memtracer_t::start()
+{
+  stopping.store(false, std::memory_order_relaxed);
+  thread = std::thread(&async_memtracer_t::run, this);
+}
+
+void async_memtracer_t::stop()
+{
+  drain();
+  stopping.store(true, std::memory_order_release);
+  thread.join();
+}
+
+void async_memtracer_t::run()
+{
+  unsigned idle = 0;
+  while (!stopping.load(std::memory_order_acquire)) {
+    // the next slot in the order they were filled heads one of the rings
+    uint64_t seq = traced.load(std::memory_order_relaxed);
+    async_memtracer_hart_t* hart = NULL;
+    async_memtracer_hart_t::slot_t* slot = NULL;
+    for (auto& h : harts) {
+      uint64_t tail = h->tail.load(std::memory_order_relaxed);
+      if (tail != h->head.load(std::memory_order_acquire) &&
+          h->slots[tail % h->SLOTS].seq == seq) {
+        hart = h.get();
+        slot = &h->slots[tail % h->SLOTS];
+        break;
+      }
+    }
+
+    if (!slot) {
+      // keep up with a busy hart, without spinning on an idle one
+      if (++idle < 64)
+        std::this_thread::yield();
+      else
+        std::this_thread::sleep_for(std::chrono::microseconds(50));
+      continue;
+    }
+    idle = 0;
+
+    if (slot->size == 0) {
+      tracers.clean_invalidate(slot->addr, slot->bytes, slot->clean, slot->inval);
+    } else {
+      memtrace_batch_t batch = {slot->size, slot->addrs, slot->sizes, slot->types,
+                                slot->harts, slot->pcs};
+      tracers.trace_batch(batch);
+    }
+    hart->tail.store(hart->tail.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    traced.store(seq + 1, std::memory_order_release);
+  }
+}
+
+void async_memtracer_t::before_fork()
+{
+  instances_lock.lock();
+  for (auto instance : instances)
+    instance->stop();
+}
+
+void async_memtracer_t::after_fork()
+{
+  for (auto instance : instances)
+    instance->start();
+  instances_lock.unlock();
+}
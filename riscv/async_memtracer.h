@@ -0,0 +1,98 @@
+// See LICENSE for license details.
+
+#ifndef _RISCV_ASYNC_MEMTRACER_H
+#define _RISCV_ASYNC_MEMTRACER_H
+
+#include "memtracer.h"
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <vector>
+
+class async_memtracer_t;
+
+// The memtracer a hart is given in place of the tracers an
+// async_memtracer_t runs.  It copies the batches the hart hands it into a
+// ring of slots, which only it fills and only the tracer thread empties.
+class async_memtracer_hart_t : public memtracer_t
+{
+ public:
+  bool interested_in_range(uint64_t begin, uint64_t end, access_type type);
+  void trace(uint64_t addr, size_t bytes, access_type type);
+  void trace_batch(const memtrace_batch_t& batch);
+  void clean_invalidate(uint64_t addr, size_t bytes, bool clean, bool inval);
+
+ private:
+  friend class async_memtracer_t;
+
+  static const size_t SLOTS = 8;
+  static const size_t SLOT_SIZE = 4096;
+
+  // a batch of up to SLOT_SIZE accesses, or, if size is 0, a clean or
+  // invalidate of the bytes at addr
+  struct slot_t {
+    uint64_t seq; // the order in which the slots of all harts were filled
+    size_t size;
+    uint64_t addr;
+    size_t bytes;
+    bool clean;
+    bool inval;
+    uint64_t addrs[SLOT_SIZE];
+    uint32_t sizes[SLOT_SIZE];
+    uint8_t types[SLOT_SIZE];
+    uint32_t harts[SLOT_SIZE];
+    uint64_t pcs[SLOT_SIZE];
+  };
+
+  async_memtracer_hart_t(async_memtracer_t* owner);
+
+  async_memtracer_t* owner;
+  std::vector<slot_t> slots;
+  std::atomic<uint64_t> head; // advanced by the hart as it fills slots
+  std::atomic<uint64_t> tail; // advanced by the tracer thread
+
+  slot_t& acquire();
+  void publish(slot_t& slot);
+};
+
+// Runs memtracers on a host thread of their own, so that the harts and the
+// tracers (e.g. the cache models) run at the same time.  Each hart is given
+// its own async_memtracer_hart_t, and the thread takes the batches from
+// their rings in the order the harts handed them over, so the tracers see
+// the same accesses in the same order as if the harts called them.
+class async_memtracer_t
+{
+ public:
+  async_memtracer_t(size_t nharts);
+  ~async_memtracer_t(); // traces everything handed over so far
+
+  memtracer_t* get_hart(size_t i) { return harts[i].get(); }
+
+  // the tracers to run, which may be changed while the harts are stopped
+  void hook(memtracer_t* tracer);
+  void unhook(memtracer_t* tracer);
+
+  // wait until the tracers have seen everything handed over so far
+  void drain();
+
+ private:
+  friend class async_memtracer_hart_t;
+
+  std::vector<std::unique_ptr<async_memtracer_hart_t>> harts;
+  memtracer_list_t tracers;
+  std::atomic<uint64_t> next_seq; // of the next slot to be filled
+  std::atomic<uint64_t> traced; // slots the tracers have seen
+  std::atomic<bool> stopping;
+  std::thread thread;
+
+  void start();
+  void stop();
+  void run();
+
+  // the thread does not survive a fork (see sim_t::set_fork()), so it is
+  // stopped before one and started again on both sides
+  static void before_fork();
+  static void after_fork();
+};
+
+#endif
@@ -0,0 +1,44 @@
+// See LICENSE for license details.
+
+#include "bbv.h"
+#include <errno.h>
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+
+bbv_profiler_t::bbv_profiler_t(const char* path, uint64_t interval)
+  : interval(interval), interval_insns(0), counts(1)
+{
+  file = fopen(path, "w");
+  if (!file) {
+    fprintf(stderr, "could not open BBV file %s: %s\n", path, strerror(errno));
+    exit(1);
+  }
+}
+
+bbv_profiler_t::~bbv_profiler_t()
+{
+  if (interval_insns)
+    end_interval();
+  fclose(file);
+}
+
+uint32_t bbv_profiler_t::block_id(reg_t pc)
+{
+  auto it = ids.emplace(pc, counts.size());
+  if (it.second)
+    counts.push_back(0);
+  return it.first->second;
+}
+
+void bbv_profiler_t::end_interval()
+{
+  fputc('T', file);
+  for (auto id : touched) {
+    fprintf(file, ":%" PRIu32 ":%" PRIu64 " ", id, counts[id]);
+    counts[id] = 0;
+  }
+  fputc('\n', file);
+  touched.clear();
+  interval_insns = 0;
+}
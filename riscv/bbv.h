@@ -0,0 +1,50 @@
+// See LICENSE for license details.
+
+#ifndef _RISCV_BBV_H
+#define _RISCV_BBV_H
+
+#include "decode.h"
+#include "common.h"
+#include <stdio.h>
+#include <unordered_map>
+#include <vector>
+
+// Collects basic-block vectors in the format of SimPoint's .bb files: one
+// line per interval of about interval instructions, listing each block that
+// ran in it by its number, with how many instructions it executed there,
+// e.g. "T:1:2400 :7:130".  Blocks are numbered from 1 in the order they are
+// first seen.
+class bbv_profiler_t
+{
+public:
+  // open path, exiting with an error message on failure
+  bbv_profiler_t(const char* path, uint64_t interval);
+  ~bbv_profiler_t(); // writes out the last, partial interval
+
+  // count insns instructions executed in the block at pc.  id caches the
+  // block's number for the caller; it starts out as 0.
+  void record(uint32_t& id, reg_t pc, size_t insns)
+  {
+    if (unlikely(id == 0))
+      id = block_id(pc);
+    if (counts[id] == 0)
+      touched.push_back(id);
+    counts[id] += insns;
+    interval_insns += insns;
+    if (unlikely(interval_insns >= interval))
+      end_interval();
+  }
+
+private:
+  FILE* file;
+  uint64_t interval;
+  uint64_t interval_insns;
+  std::unordered_map<reg_t, uint32_t> ids;
+  std::vector<uint64_t> counts; // by block number, for this interval
+  std::vector<uint32_t> touched; // blocks with nonzero counts
+
+  uint32_t block_id(reg_t pc);
+  void end_interval();
+};
+
+#endif
@@ -0,0 +1,183 @@
+// See LICENSE for license details.
+
+#include "branch_profiler.h"
+#include "processor.h"
+#include "disasm.h"
+#include <errno.h>
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+
+static const char MAGIC[8] = {'S', 'P', 'I', 'K', 'E', 'B', 'R', 'P'};
+static const uint32_t VERSION = 1;
+
+static const char* const kind_names[] = {
+  "cond", "jump", "call", "ret", "indirect"
+};
+
+static bool is_link(unsigned reg)
+{
+  return reg == 1 || reg == 5;
+}
+
+int branch_profiler_t::classify(insn_t insn, unsigned xlen)
+{
+  insn_bits_t bits = insn.bits();
+  switch (bits & 0x7f) {
+    case 0x63:
+      return branch_profiler_t::COND;
+    case 0x6f:
+      return is_link(insn.rd()) ? branch_profiler_t::CALL : branch_profiler_t::JUMP;
+    case 0x67:
+      if (is_link(insn.rd()))
+        return branch_profiler_t::CALL;
+      if (insn.rd() == 0 && is_link(insn.rs1()))
+        return branch_profiler_t::RET;
+      return branch_profiler_t::INDIRECT;
+  }
+
+  switch (bits & 0xe003) {
+    case 0xc001: // c.beqz
+    case 0xe001: // c.bnez
+      return branch_profiler_t::COND;
+    case 0xa001: // c.j
+      return branch_profiler_t::JUMP;
+    case 0x2001: // c.jal, which is c.addiw on RV64
+      return xlen == 32 ? branch_profiler_t::CALL : -1;
+    case 0x8002: // c.jr and c.jalr, if rs2 is 0 and rs1 is not
+      if ((bits & 0x7c) != 0 || insn.rvc_rs1() == 0)
+        return -1;
+      if (bits & 0x1000)
+        return branch_profiler_t::CALL;
+      return is_link(insn.rvc_rs1()) ? branch_profiler_t::RET : branch_profiler_t::INDIRECT;
+  }
+  return -1;
+}
+
+branch_profiler_t::branch_profiler_t(processor_t* proc, const char* path, bool binary)
+  : proc(proc), binary(binary), table(1024), used(0)
+{
+  file = fopen(path, binary ? "wb" : "w");
+  if (!file) {
+    fprintf(stderr, "could not open branch profile %s: %s\n", path, strerror(errno));
+    exit(1);
+  }
+}
+
+branch_profiler_t::~branch_profiler_t()
+{
+  std::vector<const branch_site_t*> sites;
+  for (auto& site : table)
+    if (site.insn != 0)
+      sites.push_back(&site);
+  std::sort(sites.begin(), sites.end(), [](const branch_site_t* a, const branch_site_t* b) {
+    return a->executed != b->executed ? a->executed > b->executed : a->pc < b->pc;
+  });
+
+  if (binary)
+    write_binary(sites);
+  else
+    write_csv(sites);
+  fclose(file);
+}
+
+void branch_profiler_t::retire(processor_t* p, reg_t pc, insn_t insn, reg_t npc)
+{
+  int kind = classify(insn, p->get_xlen());
+  if (kind < 0)
+    return;
+
+  branch_site_t& site = lookup(pc);
+  if (site.insn == 0) {
+    site.insn = insn.bits();
+    site.kind = kind;
+  }
+
+  bool taken = npc != pc + insn.length();
+  if (site.executed != 0)
+    site.transitions[site.last_taken][taken]++;
+  site.last_taken = taken;
+  site.executed++;
+  if (!taken)
+    return;
+
+  site.taken++;
+  for (size_t i = 0; i < branch_site_t::TARGETS; i++) {
+    if (site.target_counts[i] == 0)
+      site.targets[i] = npc;
+    if (site.targets[i] == npc) {
+      site.target_counts[i]++;
+      return;
+    }
+  }
+  site.other_targets++;
+}
+
+branch_site_t& branch_profiler_t::lookup(reg_t pc)
+{
+  size_t mask = table.size() - 1;
+  size_t i = ((pc >> 1) * 0x9e3779b97f4a7c15ULL) >> 32 & mask;
+  for ( ; table[i].insn != 0; i = (i + 1) & mask)
+    if (table[i].pc == pc)
+      return table[i];
+
+  // keep the table at most half full, so that probes stay short
+  if (2 * (used + 1) > table.size()) {
+    grow();
+    return lookup(pc);
+  }
+  used++;
+  table[i].pc = pc;
+  return table[i];
+}
+
+void branch_profiler_t::grow()
+{
+  std::vector<branch_site_t> old(table.size() * 2);
+  old.swap(table);
+  used = 0;
+  for (auto& site : old) {
+    if (site.insn != 0) {
+      lookup(site.pc) = site;
+    }
+  }
+}
+
+void branch_profiler_t::write_csv(const std::vector<const branch_site_t*>& sites)
+{
+  fprintf(file, "pc,insn,kind,executed,taken,not_taken,"
+                "taken_after_taken,not_taken_after_taken,"
+                "taken_after_not_taken,not_taken_after_not_taken,targets\n");
+  for (auto site : sites) {
+    const disasm_insn_t* disasm = proc->get_disassembler()->lookup(site->insn);
+    fprintf(file, "0x%" PRIx64 ",%s,%s,%" PRIu64 ",%" PRIu64 ",%" PRIu64 ","
+                  "%" PRIu64 ",%" PRIu64 ",%" PRIu64 ",%" PRIu64 ",",
+            site->pc, disasm ? disasm->get_name() : "unknown", kind_names[site->kind],
+            site->executed, site->taken, site->executed - site->taken,
+            site->transitions[1][1], site->transitions[1][0],
+            site->transitions[0][1], site->transitions[0][0]);
+
+    // targets as 0x<pc>:<count>, separated by spaces
+    const char* sep = "";
+    for (size_t i = 0; i < branch_site_t::TARGETS && site->target_counts[i]; i++) {
+      fprintf(file, "%s0x%" PRIx64 ":%" PRIu64, sep, site->targets[i], site->target_counts[i]);
+      sep = " ";
+    }
+    if (site->other_targets)
+      fprintf(file, "%sother:%" PRIu64, sep, site->other_targets);
+    fprintf(file, "\n");
+  }
+}
+
+void branch_profiler_t::write_binary(const std::vector<const branch_site_t*>& sites)
+{
+  uint32_t size = sizeof(branch_site_t);
+  uint64_t count = sites.size();
+  fwrite(MAGIC, 1, sizeof MAGIC, file);
+  fwrite(&VERSION, sizeof VERSION, 1, file);
+  fwrite(&size, sizeof size, 1, file);
+  fwrite(&count, sizeof count, 1, file);
+  for (auto site : sites)
+    fwrite(site, sizeof *site, 1, file);
+}
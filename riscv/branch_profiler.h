@@ -0,0 +1,62 @@
+// See LICENSE for license details.
+
+#ifndef _RISCV_BRANCH_PROFILER_H
+#define _RISCV_BRANCH_PROFILER_H
+
+#include "profiler.h"
+#include <stdio.h>
+#include <vector>
+
+// One branch or jump instruction, as seen by branch_profiler_t.  The binary
+// profile is an array of these in host byte order.
+struct branch_site_t {
+  static const size_t TARGETS = 4;
+
+  uint64_t pc;
+  uint32_t insn; // 0 in an unused slot of the table
+  uint8_t kind; // branch_profiler_t::kind_t
+  uint8_t last_taken;
+  uint16_t reserved;
+  uint64_t executed;
+  uint64_t taken;
+  uint64_t transitions[2][2]; // by previous and then this outcome; 1 = taken
+  uint64_t targets[TARGETS]; // the first few targets taken, with their counts
+  uint64_t target_counts[TARGETS];
+  uint64_t other_targets; // times the branch was taken to any other target
+};
+
+// Profiles every branch and jump site of a hart: how often it was executed
+// and taken, where it went, and how its outcome followed the previous one,
+// for branch predictor studies.  The sites are kept in an open-addressing
+// hash table keyed by pc, and written out when the profiler is destroyed,
+// most executed first, either as CSV or in binary: the magic "SPIKEBRP", a
+// uint32_t version, a uint32_t sizeof(branch_site_t), a uint64_t count and
+// then that many branch_site_t.
+class branch_profiler_t : public insn_profiler_t
+{
+ public:
+  enum kind_t { COND, JUMP, CALL, RET, INDIRECT };
+
+  // the kind of branch insn is, or -1 if it is none
+  static int classify(insn_t insn, unsigned xlen);
+
+  // open path, exiting with an error message on failure
+  branch_profiler_t(processor_t* proc, const char* path, bool binary);
+  ~branch_profiler_t();
+
+  void retire(processor_t* p, reg_t pc, insn_t insn, reg_t npc);
+
+ private:
+  processor_t* proc;
+  FILE* file;
+  bool binary;
+  std::vector<branch_site_t> table; // a power of 2 in size
+  size_t used;
+
+  branch_site_t& lookup(reg_t pc);
+  void grow();
+  void write_csv(const std::vector<const branch_site_t*>& sites);
+  void write_binary(const std::vector<const branch_site_t*>& sites);
+};
+
+#endif
@@ -0,0 +1,47 @@
+// See LICENSE for license details.
+
+#include "branch_stats.h"
+#include <inttypes.h>
+#include <stdio.h>
+
+static const char* const kind_names[] = {
+  "beq", "bne", "blt", "bge", "bltu", "bgeu", "c.beqz", "c.bnez"
+};
+
+branch_stats_t::branch_stats_t(uint32_t id)
+  : id(id), executed(), taken()
+{
+}
+
+void branch_stats_t::retire(processor_t* p, reg_t pc, insn_t insn, reg_t npc)
+{
+  // conditional branches, by funct3 of the BRANCH major opcode
+  static const int branch_kinds[8] = { BEQ, BNE, -1, -1, BLT, BGE, BLTU, BGEU };
+
+  insn_bits_t bits = insn.bits();
+  int kind;
+  if ((bits & 0x7f) == 0x63)
+    kind = branch_kinds[(bits >> 12) & 7];
+  else if ((bits & 0xe003) == 0xc001)
+    kind = C_BEQZ;
+  else if ((bits & 0xe003) == 0xe001)
+    kind = C_BNEZ;
+  else
+    return;
+
+  if (kind < 0)
+    return;
+  executed[kind]++;
+  taken[kind] += npc != pc + insn.length();
+}
+
+void branch_stats_t::print() const
+{
+  for (int kind = 0; kind < NKINDS; kind++) {
+    if (executed[kind] == 0)
+      continue;
+    printf("Branch%u %-7s Executed: %14" PRIu64 "  Taken: %14" PRIu64 " (%.3f%%)\n",
+           id, kind_names[kind], executed[kind], taken[kind],
+           100.0 * taken[kind] / executed[kind]);
+  }
+}
@@ -0,0 +1,26 @@
+// See LICENSE for license details.
+
+#ifndef _RISCV_BRANCH_STATS_H
+#define _RISCV_BRANCH_STATS_H
+
+#include "profiler.h"
+
+// Counts how often each kind of conditional branch was executed and how often
+// it was taken, for --branch-stats.
+class branch_stats_t : public insn_profiler_t
+{
+ public:
+  branch_stats_t(uint32_t id);
+
+  void retire(processor_t* p, reg_t pc, insn_t insn, reg_t npc);
+  void print() const;
+
+ private:
+  enum { BEQ, BNE, BLT, BGE, BLTU, BGEU, C_BEQZ, C_BNEZ, NKINDS };
+
+  uint32_t id;
+  uint64_t executed[NKINDS];
+  uint64_t taken[NKINDS];
+};
+
+#endif
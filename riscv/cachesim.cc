@@ -49,6 +49,7 @@ void cache_sim_t::init()
     idx_shift++;
 
   tags = new uint64_t[sets*ways]();
+  last_hit = NULL;
   read_accesses = 0;
   read_misses = 0;
   bytes_read = 0;
@@ -66,6 +67,7 @@ cache_sim_t::cache_sim_t(const cache_sim_t& rhs)
 {
   tags = new uint64_t[sets*ways];
   memcpy(tags, rhs.tags, sets*ways*sizeof(uint64_t));
+  last_hit = NULL;
 }
 
 cache_sim_t::~cache_sim_t()
@@ -126,14 +128,18 @@ void cache_sim_t::access(uint64_t addr, size_t bytes, bool store)
   store ? write_accesses++ : read_accesses++;
   (store ? bytes_written : bytes_read) += bytes;
 
-  uint64_t* hit_way = check_tag(addr);
+  uint64_t tag = (addr >> idx_shift) | VALID;
+  uint64_t* hit_way = last_hit && tag == last_tag ? last_hit : check_tag(addr);
   if (likely(hit_way != NULL))
   {
     if (store)
       *hit_way |= DIRTY;
+    last_hit = hit_way;
+    last_tag = tag;
     return;
   }
 
+  last_hit = NULL;
   store ? write_misses++ : read_misses++;
   if (log)
   {
@@ -161,6 +167,7 @@ void cache_sim_t::access(uint64_t addr, size_t bytes, bool store)
 
 void cache_sim_t::clean_invalidate(uint64_t addr, size_t bytes, bool clean, bool inval)
 {
+  last_hit = NULL;
   uint64_t start_addr = addr & ~(linesz-1);
   uint64_t end_addr = (addr + bytes + linesz-1) & ~(linesz-1);
   uint64_t cur_addr = start_addr;
@@ -50,6 +50,12 @@ class cache_sim_t
   size_t idx_shift;
 
   uint64_t* tags;
+
+  // runs of accesses to one line, e.g. the fetches of straight-line code,
+  // are common.  until the next miss, the way the last access hit in still
+  // holds its line, so the tag search can be skipped.
+  uint64_t* last_hit; // NULL after a miss
+  uint64_t last_tag;
   
   uint64_t read_accesses;
   uint64_t read_misses;
@@ -116,6 +122,11 @@ class icache_sim_t : public cache_memtracer_t
   {
     if (type == FETCH) cache->access(addr, bytes, false);
   }
+  void trace_batch(const memtrace_batch_t& batch)
+  {
+    for (size_t i = 0; i < batch.size; i++)
+      if (batch.types[i] == FETCH) cache->access(batch.addrs[i], batch.bytes[i], false);
+  }
 };
 
 class dcache_sim_t : public cache_memtracer_t
@@ -130,6 +141,13 @@ class dcache_sim_t : public cache_memtracer_t
   {
     if (type == LOAD || type == STORE) cache->access(addr, bytes, type == STORE);
   }
+  void trace_batch(const memtrace_batch_t& batch)
+  {
+    for (size_t i = 0; i < batch.size; i++) {
+      if (batch.types[i] == LOAD || batch.types[i] == STORE)
+        cache->access(batch.addrs[i], batch.bytes[i], batch.types[i] == STORE);
+    }
+  }
 };
 
 #endif
@@ -0,0 +1,86 @@
+// See LICENSE for license details.
+
+#include "checkpoint.h"
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+static const char MAGIC[8] = {'S', 'P', 'I', 'K', 'E', 'C', 'K', 'P'};
+
+checkpoint_t::checkpoint_t(const char* path, bool restoring)
+  : path(path), is_restoring(restoring)
+{
+  file = fopen(path, restoring ? "rb" : "wb");
+  if (!file) {
+    fprintf(stderr, "could not open checkpoint %s: %s\n", path, strerror(errno));
+    exit(1);
+  }
+
+  char magic[sizeof MAGIC];
+  uint32_t version = VERSION;
+  memcpy(magic, MAGIC, sizeof MAGIC);
+  io(magic, sizeof magic);
+  io(version);
+  if (memcmp(magic, MAGIC, sizeof MAGIC) != 0)
+    mismatch("file is not a checkpoint");
+  if (version != VERSION)
+    mismatch("checkpoint version " + std::to_string(version) + " is not supported");
+}
+
+checkpoint_t::~checkpoint_t()
+{
+  if (fclose(file) != 0) {
+    fprintf(stderr, "could not write checkpoint %s: %s\n", path.c_str(), strerror(errno));
+    exit(1);
+  }
+}
+
+void checkpoint_t::io(void* data, size_t len)
+{
+  if (len == 0)
+    return;
+
+  if (is_restoring) {
+    if (fread(data, 1, len, file) != len)
+      mismatch("checkpoint is truncated");
+  } else if (fwrite(data, 1, len, file) != len) {
+    fprintf(stderr, "could not write checkpoint %s: %s\n", path.c_str(), strerror(errno));
+    exit(1);
+  }
+}
+
+void checkpoint_t::io(std::vector<bool>& values)
+{
+  uint64_t size = values.size();
+  io(size);
+  if (is_restoring)
+    values.resize(size);
+  for (size_t i = 0; i < size; i++) {
+    bool value = values[i];
+    io(value);
+    values[i] = value;
+  }
+}
+
+void checkpoint_t::section(const char* name, uint64_t value)
+{
+  std::string found = name;
+  uint64_t found_value = value;
+  io(found_value);
+  uint32_t len = found.size();
+  io(len);
+  found.resize(len);
+  io(&found[0], len);
+
+  if (found != name)
+    mismatch("expected " + std::string(name) + " but found " + found);
+  if (found_value != value)
+    mismatch(std::string(name) + " " + std::to_string(found_value) +
+             " does not match this machine's " + std::to_string(value));
+}
+
+void checkpoint_t::mismatch(const std::string& what)
+{
+  fprintf(stderr, "could not restore checkpoint %s: %s\n", path.c_str(), what.c_str());
+  exit(1);
+}
@@ -0,0 +1,69 @@
+// See LICENSE for license details.
+
+#ifndef _RISCV_CHECKPOINT_H
+#define _RISCV_CHECKPOINT_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+// A checkpoint file of a simulated machine, open for saving or restoring.
+//
+// Each component describes its state once, in a checkpoint() method that
+// passes its fields to io(): when saving, io() writes them out, and when
+// restoring, it reads them back in the same order.  Fields are stored in
+// host byte order, so a checkpoint can only be restored by a simulator built
+// for a host of the same endianness.  The file starts with a magic number and
+// a version, which must be bumped whenever the layout of any component
+// changes.
+class checkpoint_t
+{
+public:
+  // open path, exiting with an error message on failure
+  checkpoint_t(const char* path, bool restoring);
+  ~checkpoint_t();
+
+  bool restoring() const { return is_restoring; }
+
+  void io(void* data, size_t len);
+
+  template<typename T>
+  void io(T& value)
+  {
+    static_assert(std::is_trivially_copyable<T>::value, "only plain data can be checkpointed");
+    io(&value, sizeof value);
+  }
+
+  template<typename T>
+  void io(std::vector<T>& values)
+  {
+    static_assert(std::is_trivially_copyable<T>::value, "only plain data can be checkpointed");
+    uint64_t size = values.size();
+    io(size);
+    if (is_restoring)
+      values.resize(size);
+    io(values.data(), size * sizeof(T));
+  }
+
+  void io(std::vector<bool>& values);
+
+  // mark the start of a component.  a restore fails if it finds another
+  // component or a different value, e.g. because the checkpoint was taken
+  // of a machine with more harts or other memory regions.
+  void section(const char* name, uint64_t value = 0);
+
+  // fail a restore of a checkpoint that does not fit this machine
+  void mismatch(const std::string& what);
+
+private:
+  FILE* file;
+  std::string path;
+  bool is_restoring;
+
+  static const uint32_t VERSION = 1;
+};
+
+#endif
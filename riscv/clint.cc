@@ -1,6 +1,7 @@
 #include <sys/time.h>
 #include "devices.h"
 #include "processor.h"
+#include "checkpoint.h"
 
 clint_t::clint_t(std::vector<processor_t*>& procs, uint64_t freq_hz, bool real_time)
   : procs(procs), freq_hz(freq_hz), real_time(real_time), mtime(0), mtimecmp(procs.size())
@@ -88,3 +89,14 @@ void clint_t::increment(reg_t inc)
       procs[i]->state.mip->backdoor_write_with_mask(MIP_MTIP, MIP_MTIP);
   }
 }
+
+// with a real-time clint, mtime follows the host clock again after a restore
+void clint_t::checkpoint(checkpoint_t& c)
+{
+  c.section("clint", procs.size());
+  c.io(mtime);
+  c.io(mtimecmp);
+  if (c.restoring())
+    for (auto proc : procs)
+      proc->state.time->sync(mtime);
+}
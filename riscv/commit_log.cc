@@ -0,0 +1,401 @@
+// See LICENSE for license details.
+
+#include "commit_log.h"
+#include "processor.h"
+#include "disasm.h"
+#include <assert.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include <map>
+
+static const char MAGIC[8] = {'S', 'P', 'I', 'K', 'E', 'C', 'L', 'G'};
+static const uint32_t VERSION = 1;
+
+// the flags byte that starts each record
+#define RECORD_PRIV_MASK   0x03
+#define RECORD_XLEN64      0x04
+#define RECORD_FLEN_SHIFT  3 // 0, 32, 64 or 128 as 0..3
+#define RECORD_HAS_VECTOR  0x20
+
+void commit_log_print_value(FILE *log_file, int width, const void *data)
+{
+  assert(log_file);
+
+  switch (width) {
+    case 8:
+      fprintf(log_file, "0x%01" PRIx8, *(const uint8_t *)data);
+      break;
+    case 16:
+      fprintf(log_file, "0x%04" PRIx16, *(const uint16_t *)data);
+      break;
+    case 32:
+      fprintf(log_file, "0x%08" PRIx32, *(const uint32_t *)data);
+      break;
+    case 64:
+      fprintf(log_file, "0x%016" PRIx64, *(const uint64_t *)data);
+      break;
+    default:
+      // max lengh of vector
+      if (((width - 1) & width) == 0) {
+        const uint64_t *arr = (const uint64_t *)data;
+
+        fprintf(log_file, "0x");
+        for (int idx = width / 64 - 1; idx >= 0; --idx) {
+          fprintf(log_file, "%016" PRIx64, arr[idx]);
+        }
+      } else {
+        abort();
+      }
+      break;
+  }
+}
+
+static void put_varint(std::vector<uint8_t>& buf, uint64_t value)
+{
+  while (value >= 0x80) {
+    buf.push_back(value | 0x80);
+    value >>= 7;
+  }
+  buf.push_back(value);
+}
+
+static void put_bytes(std::vector<uint8_t>& buf, const void* data, size_t len)
+{
+  const uint8_t* bytes = (const uint8_t*)data;
+  buf.insert(buf.end(), bytes, bytes + len);
+}
+
+commit_log_ring_t::commit_log_ring_t(uint32_t hartid)
+  : hartid(hartid), data(SIZE), head(0), tail(0), next_pc(0)
+{
+}
+
+void commit_log_ring_t::record(processor_t* p, reg_t pc, insn_t insn)
+{
+#ifdef RISCV_ENABLE_COMMITLOG
+  state_t* state = p->get_state();
+  int xlen = state->last_inst_xlen;
+  int flen = state->last_inst_flen;
+  reg_t xmask = xlen == 64 ? reg_t(-1) : reg_t(UINT32_MAX);
+
+  uint8_t flags = (state->last_inst_priv & RECORD_PRIV_MASK) |
+                  (xlen == 64 ? RECORD_XLEN64 : 0) |
+                  ((flen == 128 ? 3 : flen / 32) << RECORD_FLEN_SHIFT);
+  for (auto item : state->log_reg_write)
+    if ((item.first & 0xf) == 2 || (item.first & 0xf) == 3)
+      flags |= RECORD_HAS_VECTOR;
+
+  buf.clear();
+  buf.push_back(flags);
+  int64_t delta = pc - next_pc;
+  put_varint(buf, (uint64_t(delta) << 1) ^ uint64_t(delta >> 63));
+  put_varint(buf, insn.bits());
+  next_pc = pc + insn.length();
+
+  if (flags & RECORD_HAS_VECTOR) {
+    bool fractional = p->VU.vflmul < 1;
+    reg_t lmul = fractional ? (reg_t)(1 / p->VU.vflmul) : (reg_t)p->VU.vflmul;
+    put_varint(buf, p->VU.VLEN);
+    put_varint(buf, p->VU.vsew);
+    put_varint(buf, (lmul << 1) | fractional);
+    put_varint(buf, p->VU.vl->read());
+  }
+
+  size_t nregs = state->log_reg_write.size() - state->log_reg_write.count(0);
+  put_varint(buf, nregs);
+  for (auto item : state->log_reg_write) {
+    if (item.first == 0)
+      continue;
+
+    put_varint(buf, item.first);
+    switch (item.first & 0xf) {
+    case 0:
+    case 4:
+      put_varint(buf, item.second.v[0] & xmask);
+      break;
+    case 1:
+      put_bytes(buf, item.second.v, flen / 8);
+      break;
+    case 2:
+      put_bytes(buf, &p->VU.elt<uint8_t>(item.first >> 4, 0), p->VU.VLEN / 8);
+      break;
+    }
+  }
+
+  put_varint(buf, state->log_mem_read.size());
+  for (auto item : state->log_mem_read)
+    put_varint(buf, std::get<0>(item) & xmask);
+
+  put_varint(buf, state->log_mem_write.size());
+  for (auto item : state->log_mem_write) {
+    put_varint(buf, std::get<0>(item) & xmask);
+    buf.push_back(std::get<2>(item));
+    put_varint(buf, std::get<1>(item));
+  }
+
+  push(buf.data(), buf.size());
+#endif
+}
+
+void commit_log_ring_t::push(const uint8_t* bytes, size_t len)
+{
+  assert(len <= SIZE);
+
+  // the ring is full: wait for the writer thread to catch up
+  uint64_t h = head.load(std::memory_order_relaxed);
+  while (h + len - tail.load(std::memory_order_acquire) > SIZE)
+    std::this_thread::yield();
+
+  size_t offset = h % SIZE;
+  size_t first = std::min(len, SIZE - offset);
+  memcpy(&data[offset], bytes, first);
+  memcpy(&data[0], bytes + first, len - first);
+  head.store(h + len, std::memory_order_release);
+}
+
+commit_log_writer_t::commit_log_writer_t(const char* path, const std::vector<uint32_t>& hartids)
+  : stopping(false)
+{
+  file = fopen(path, "wb");
+  if (!file) {
+    fprintf(stderr, "could not open commit log %s: %s\n", path, strerror(errno));
+    exit(1);
+  }
+  fwrite(MAGIC, 1, sizeof MAGIC, file);
+  fwrite(&VERSION, sizeof VERSION, 1, file);
+
+  for (auto hartid : hartids)
+    rings.emplace_back(new commit_log_ring_t(hartid));
+  thread = std::thread(&commit_log_writer_t::run, this);
+}
+
+commit_log_writer_t::~commit_log_writer_t()
+{
+  stopping.store(true, std::memory_order_release);
+  thread.join();
+
+  if (ferror(file) || fclose(file) != 0) {
+    fprintf(stderr, "could not write commit log: %s\n", strerror(errno));
+    exit(1);
+  }
+}
+
+void commit_log_writer_t::run()
+{
+  while (true) {
+    // anything recorded before stopping was set is drained below
+    bool stop = stopping.load(std::memory_order_acquire);
+    bool drained = false;
+    for (auto& ring : rings)
+      drained |= drain(*ring);
+    if (stop)
+      break;
+    if (!drained)
+      std::this_thread::sleep_for(std::chrono::microseconds(100));
+  }
+}
+
+bool commit_log_writer_t::drain(commit_log_ring_t& ring)
+{
+  uint64_t head = ring.head.load(std::memory_order_acquire);
+  uint64_t tail = ring.tail.load(std::memory_order_relaxed);
+  if (head == tail)
+    return false;
+
+  size_t len = head - tail;
+  size_t offset = tail % ring.SIZE;
+  size_t first = std::min(len, ring.SIZE - offset);
+  uint32_t header[2] = {ring.hartid, uint32_t(len)};
+  fwrite(header, sizeof header, 1, file);
+  fwrite(&ring.data[offset], 1, first, file);
+  fwrite(&ring.data[0], 1, len - first, file);
+
+  ring.tail.store(head, std::memory_order_release);
+  return true;
+}
+
+// reads the fields of the records in one chunk
+class record_reader_t
+{
+public:
+  record_reader_t(const uint8_t* p, const uint8_t* end) : p(p), end(end) {}
+
+  bool done() const { return p == end; }
+
+  bool varint(uint64_t& value)
+  {
+    value = 0;
+    for (int shift = 0; shift < 64 && p != end; shift += 7) {
+      uint8_t byte = *p++;
+      value |= uint64_t(byte & 0x7f) << shift;
+      if (!(byte & 0x80))
+        return true;
+    }
+    return false;
+  }
+
+  bool bytes(const uint8_t*& data, size_t len)
+  {
+    if (size_t(end - p) < len)
+      return false;
+    data = p;
+    p += len;
+    return true;
+  }
+
+private:
+  const uint8_t* p;
+  const uint8_t* end;
+};
+
+// print one record in the format of commit_log_print_insn
+static bool decode_record(record_reader_t& r, uint32_t hartid, reg_t& next_pc, FILE* out)
+{
+  const uint8_t* flags_byte;
+  uint64_t delta, bits;
+  if (!r.bytes(flags_byte, 1) || !r.varint(delta) || !r.varint(bits))
+    return false;
+
+  uint8_t flags = *flags_byte;
+  int priv = flags & RECORD_PRIV_MASK;
+  int xlen = flags & RECORD_XLEN64 ? 64 : 32;
+  int flen_code = (flags >> RECORD_FLEN_SHIFT) & 3;
+  int flen = flen_code == 3 ? 128 : flen_code * 32;
+  reg_t pc = next_pc + ((delta >> 1) ^ -(delta & 1));
+  insn_t insn(bits);
+  next_pc = pc + insn.length();
+
+  uint64_t vlen = 0, vsew = 0, lmul = 0, vl = 0;
+  if ((flags & RECORD_HAS_VECTOR) &&
+      (!r.varint(vlen) || !r.varint(vsew) || !r.varint(lmul) || !r.varint(vl)))
+    return false;
+
+  fprintf(out, "core%4" PRId32 ": ", hartid);
+  fprintf(out, "%1d ", priv);
+  commit_log_print_value(out, xlen, &pc);
+  fprintf(out, " (");
+  commit_log_print_value(out, insn.length() * 8, &bits);
+  fprintf(out, ")");
+  bool show_vec = false;
+
+  uint64_t nregs;
+  if (!r.varint(nregs))
+    return false;
+  for (uint64_t i = 0; i < nregs; i++) {
+    uint64_t key, value = 0;
+    const uint8_t* data = (const uint8_t*)&value;
+    if (!r.varint(key))
+      return false;
+
+    char prefix = 0;
+    int size = 0;
+    int rd = key >> 4;
+    switch (key & 0xf) {
+    case 0:
+    case 4:
+      if (!r.varint(value))
+        return false;
+      size = xlen;
+      prefix = (key & 0xf) == 0 ? 'x' : 'c';
+      break;
+    case 1:
+      if (!r.bytes(data, flen / 8))
+        return false;
+      size = flen;
+      prefix = 'f';
+      break;
+    case 2:
+      if (!(flags & RECORD_HAS_VECTOR) || !r.bytes(data, vlen / 8))
+        return false;
+      size = vlen;
+      prefix = 'v';
+      break;
+    case 3:
+      break;
+    default:
+      return false;
+    }
+
+    if (!show_vec && (prefix == 'v' || prefix == 0)) {
+      fprintf(out, " e%" PRIu64 " %s%" PRIu64 " l%" PRIu64,
+              vsew, lmul & 1 ? "mf" : "m", lmul >> 1, vl);
+      show_vec = true;
+    }
+
+    if (prefix != 0) {
+      if (prefix == 'c')
+        fprintf(out, " c%d_%s ", rd, csr_name(rd));
+      else
+        fprintf(out, " %c%-2d ", prefix, rd);
+      // copy out wide values, which need not be aligned in the chunk
+      std::vector<uint64_t> aligned((size + 63) / 64);
+      memcpy(aligned.data(), data, size / 8);
+      commit_log_print_value(out, size, aligned.data());
+    }
+  }
+
+  uint64_t nloads, nstores;
+  if (!r.varint(nloads))
+    return false;
+  for (uint64_t i = 0; i < nloads; i++) {
+    uint64_t addr;
+    if (!r.varint(addr))
+      return false;
+    fprintf(out, " mem ");
+    commit_log_print_value(out, xlen, &addr);
+  }
+
+  if (!r.varint(nstores))
+    return false;
+  for (uint64_t i = 0; i < nstores; i++) {
+    uint64_t addr, value;
+    const uint8_t* size;
+    if (!r.varint(addr) || !r.bytes(size, 1) || !r.varint(value))
+      return false;
+    fprintf(out, " mem ");
+    commit_log_print_value(out, xlen, &addr);
+    fprintf(out, " ");
+    commit_log_print_value(out, *size << 3, &value);
+  }
+  fprintf(out, "\n");
+  return true;
+}
+
+bool commit_log_decode(FILE* in, FILE* out)
+{
+  char magic[sizeof MAGIC];
+  uint32_t version;
+  if (fread(magic, 1, sizeof magic, in) != sizeof magic ||
+      memcmp(magic, MAGIC, sizeof MAGIC) != 0) {
+    fprintf(stderr, "input is not a binary commit log\n");
+    return false;
+  }
+  if (fread(&version, sizeof version, 1, in) != 1 || version != VERSION) {
+    fprintf(stderr, "binary commit log version is not supported\n");
+    return false;
+  }
+
+  std::map<uint32_t, reg_t> next_pcs;
+  std::vector<uint8_t> chunk;
+  uint32_t header[2];
+  while (fread(header, sizeof header, 1, in) == 1) {
+    chunk.resize(header[1]);
+    if (fread(chunk.data(), 1, chunk.size(), in) != chunk.size()) {
+      fprintf(stderr, "binary commit log is truncated\n");
+      return false;
+    }
+
+    record_reader_t r(chunk.data(), chunk.data() + chunk.size());
+    reg_t& next_pc = next_pcs[header[0]];
+    while (!r.done()) {
+      if (!decode_record(r, header[0], next_pc, out)) {
+        fprintf(stderr, "binary commit log is corrupt\n");
+        return false;
+      }
+    }
+  }
+  return true;
+}
@@ -0,0 +1,74 @@
+// See LICENSE for license details.
+
+#ifndef _RISCV_COMMIT_LOG_H
+#define _RISCV_COMMIT_LOG_H
+
+#include "decode.h"
+#include <stdio.h>
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <vector>
+
+class processor_t;
+
+// print a register or memory value of width bits as the commit log does
+void commit_log_print_value(FILE* log_file, int width, const void* data);
+
+// The binary commit log.
+//
+// Each hart encodes the commit record of every instruction it retires into
+// its own ring buffer, and a writer thread drains the rings into the file.
+// The file starts with the magic "SPIKECLG" and a uint32_t version, followed
+// by chunks, each a uint32_t hart id, a uint32_t length and that many bytes of
+// whole records of that hart, all in host byte order.  Numbers in records are
+// LEB128 varints, and a record's pc is stored as its difference from the pc
+// after the hart's previous instruction, so most records take a few bytes.
+// commit_log_decode() turns a binary log back into the text of --log-commits.
+class commit_log_ring_t
+{
+public:
+  // encode the commit record of the instruction p just retired
+  void record(processor_t* p, reg_t pc, insn_t insn);
+
+private:
+  friend class commit_log_writer_t;
+
+  commit_log_ring_t(uint32_t hartid);
+
+  uint32_t hartid;
+  std::vector<uint8_t> data;
+  std::atomic<uint64_t> head; // advanced by the hart, at record boundaries
+  std::atomic<uint64_t> tail; // advanced by the writer thread
+  std::vector<uint8_t> buf; // the record being encoded
+  reg_t next_pc;
+
+  static const size_t SIZE = 1 << 20;
+
+  void push(const uint8_t* bytes, size_t len);
+};
+
+class commit_log_writer_t
+{
+public:
+  // open path, exiting with an error message on failure
+  commit_log_writer_t(const char* path, const std::vector<uint32_t>& hartids);
+  ~commit_log_writer_t(); // writes out everything recorded so far
+
+  commit_log_ring_t* get_ring(size_t i) { return rings[i].get(); }
+
+private:
+  FILE* file;
+  std::vector<std::unique_ptr<commit_log_ring_t>> rings;
+  std::atomic<bool> stopping;
+  std::thread thread;
+
+  void run();
+  bool drain(commit_log_ring_t& ring);
+};
+
+// write the text form of the binary commit log in to out.  returns false,
+// after printing an error message, if in is not a well-formed binary log.
+bool commit_log_decode(FILE* in, FILE* out);
+
+#endif
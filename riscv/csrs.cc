@@ -421,12 +421,12 @@ reg_t base_status_csr_t::adjust_sd(const reg_t val) const noexcept {
   return val & ~sd_bit;
 }
 
-void base_status_csr_t::maybe_flush_tlb(const reg_t newval) noexcept {
-  if ((newval ^ read()) &
-      (MSTATUS_MPP | MSTATUS_MPRV
+void base_status_csr_t::maybe_switch_tlb_context(const reg_t oldval) noexcept {
+  if ((oldval ^ read()) &
+      (MSTATUS_MPRV
        | (has_page ? (MSTATUS_MXR | MSTATUS_SUM) : 0)
       ))
-    proc->get_mmu()->flush_tlb();
+    proc->get_mmu()->switch_tlb_context();
 }
 
 namespace {
@@ -447,8 +447,9 @@ vsstatus_csr_t::vsstatus_csr_t(processor_t* const proc, const reg_t addr):
 
 bool vsstatus_csr_t::unlogged_write(const reg_t val) noexcept {
   const reg_t newval = (this->val & ~sstatus_write_mask) | (val & sstatus_write_mask);
-  if (state->v) maybe_flush_tlb(newval);
+  const reg_t oldval = this->val;
   this->val = adjust_sd(newval);
+  if (state->v) maybe_switch_tlb_context(oldval);
   return true;
 }
 
@@ -491,8 +492,9 @@ bool mstatus_csr_t::unlogged_write(const reg_t val) noexcept {
   const reg_t requested_mpp = proc->legalize_privilege(get_field(val, MSTATUS_MPP));
   const reg_t adjusted_val = set_field(val, MSTATUS_MPP, requested_mpp);
   const reg_t new_mstatus = (read() & ~mask) | (adjusted_val & mask);
-  maybe_flush_tlb(new_mstatus);
+  const reg_t oldval = read();
   this->val = adjust_sd(new_mstatus);
+  maybe_switch_tlb_context(oldval);
   return true;
 }
 
@@ -642,6 +644,10 @@ bool misa_csr_t::unlogged_write(const reg_t val) noexcept {
     state->hstatus->write(0);
   }
 
+  // translated code is specialised to the extensions enabled at the time
+  if (new_misa != old_misa)
+    proc->get_mmu()->flush_icache();
+
   return basic_csr_t::unlogged_write(new_misa);
 }
 
@@ -862,9 +868,11 @@ base_atp_csr_t::base_atp_csr_t(processor_t* const proc, const reg_t addr):
 
 bool base_atp_csr_t::unlogged_write(const reg_t val) noexcept {
   const reg_t newval = proc->supports_impl(IMPL_MMU) ? compute_new_satp(val) : 0;
-  if (newval != read())
-    proc->get_mmu()->flush_tlb();
-  return basic_csr_t::unlogged_write(newval);
+  const bool changed = newval != read();
+  const bool result = basic_csr_t::unlogged_write(newval);
+  if (changed)
+    proc->get_mmu()->switch_tlb_context();
+  return result;
 }
 
 bool base_atp_csr_t::satp_valid(reg_t val) const noexcept {
@@ -1065,8 +1073,6 @@ void hgatp_csr_t::verify_permissions(insn_t insn, bool write) const {
 }
 
 bool hgatp_csr_t::unlogged_write(const reg_t val) noexcept {
-  proc->get_mmu()->flush_tlb();
-
   reg_t mask;
   if (proc->get_const_xlen() == 32) {
     mask = HGATP32_PPN |
@@ -1083,7 +1089,9 @@ bool hgatp_csr_t::unlogged_write(const reg_t val) noexcept {
       mask |= HGATP64_MODE;
   }
   mask &= ~(reg_t)3;
-  return basic_csr_t::unlogged_write((read() & ~mask) | (val & mask));
+  const bool result = basic_csr_t::unlogged_write((read() & ~mask) | (val & mask));
+  proc->get_mmu()->switch_tlb_context();
+  return result;
 }
 
 tselect_csr_t::tselect_csr_t(processor_t* const proc, const reg_t addr):
@@ -208,7 +208,7 @@ class base_status_csr_t: public csr_t {
 
  protected:
   reg_t adjust_sd(const reg_t val) const noexcept;
-  void maybe_flush_tlb(const reg_t newval) noexcept;
+  void maybe_switch_tlb_context(const reg_t oldval) noexcept;
   const bool has_page;
   const reg_t sstatus_write_mask;
   const reg_t sstatus_read_mask;
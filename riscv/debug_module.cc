@@ -5,6 +5,7 @@
 #include "debug_defines.h"
 #include "opcodes.h"
 #include "mmu.h"
+#include "checkpoint.h"
 
 #include "debug_rom/debug_rom.h"
 #include "debug_rom_defines.h"
@@ -938,3 +939,27 @@ void debug_module_t::proc_reset(unsigned id)
   hart_state[id].halted = false;
   hart_state[id].haltgroup = 0;
 }
+
+void debug_module_t::checkpoint(checkpoint_t& c)
+{
+  c.section("debug module", nprocs);
+  c.io(debug_rom_whereto);
+  c.io(debug_abstract);
+  c.io(program_buffer, program_buffer_bytes);
+  c.io(dmdata);
+  c.io(hart_state);
+  c.io(debug_rom_flags);
+  c.io(dmcontrol);
+  c.io(dmstatus);
+  c.io(abstractcs);
+  c.io(abstractauto);
+  c.io(command);
+  c.io(hawindowsel);
+  c.io(hart_array_mask);
+  c.io(sbcs);
+  c.io(sbaddress);
+  c.io(sbdata);
+  c.io(challenge);
+  c.io(abstract_command_completed);
+  c.io(rti_remaining);
+}
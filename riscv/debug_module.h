@@ -9,6 +9,7 @@
 
 class sim_t;
 class bus_t;
+class checkpoint_t;
 
 typedef struct {
     // Size of program_buffer in 32-bit words, as exposed to the rest of the
@@ -128,6 +129,8 @@ class debug_module_t : public abstract_device_t
     // Called when one of the attached harts was reset.
     void proc_reset(unsigned id);
 
+    void checkpoint(checkpoint_t& c);
+
   private:
     static const unsigned datasize = 2;
     unsigned nprocs;
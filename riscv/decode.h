@@ -78,7 +78,7 @@ class insn_t
 {
 public:
   insn_t() = default;
-  insn_t(insn_bits_t bits) : b(bits) {}
+  insn_t(insn_bits_t bits) : b(bits) { predecode(); }
   insn_bits_t bits() { return b; }
   int length() { return insn_length(b); }
   int64_t i_imm() { return xs(20, 12); }
@@ -140,11 +140,50 @@ public:
   uint64_t p_imm5() { return x(20, 5); }
   uint64_t p_imm6() { return x(20, 6); }
 
+protected:
+  // register indices and the immediate of the instruction's format,
+  // extracted once when the instruction is fetched into the icache
+  struct {
+    uint8_t rd, rs1, rs2;
+    int32_t imm;
+  } pd;
+
 private:
   insn_bits_t b;
   uint64_t x(int lo, int len) { return (b >> lo) & ((insn_bits_t(1) << len) - 1); }
   uint64_t xs(int lo, int len) { return int64_t(b) << (64 - lo - len) >> (64 - len); }
   uint64_t imm_sign() { return xs(31, 1); }
+
+  void predecode()
+  {
+    pd.rd = rd();
+    pd.rs1 = rs1();
+    pd.rs2 = rs2();
+    switch (b & 0x7f) {
+      case 0x17: case 0x37: pd.imm = u_imm(); break;  // AUIPC, LUI
+      case 0x23: case 0x27: pd.imm = s_imm(); break;  // STORE, STORE-FP
+      case 0x63: pd.imm = sb_imm(); break;            // BRANCH
+      case 0x6f: pd.imm = uj_imm(); break;            // JAL
+      default: pd.imm = i_imm(); break;
+    }
+  }
+};
+
+// An instruction whose operands are read from the pre-decoded fields rather
+// than extracted from the encoding.  Only the handlers generated from
+// insn_template_predecoded.cc use this view.
+class predecoded_insn_t : public insn_t
+{
+public:
+  predecoded_insn_t(insn_t insn) : insn_t(insn) {}
+  int64_t i_imm() { return pd.imm; }
+  int64_t s_imm() { return pd.imm; }
+  int64_t sb_imm() { return pd.imm; }
+  int64_t u_imm() { return pd.imm; }
+  int64_t uj_imm() { return pd.imm; }
+  uint64_t rd() { return pd.rd; }
+  uint64_t rs1() { return pd.rs1; }
+  uint64_t rs2() { return pd.rs2; }
 };
 
 template <class T, size_t N, bool zero_reg>
@@ -1,54 +1,72 @@
 #include "devices.h"
 #include "mmu.h"
+#include "checkpoint.h"
+#include <algorithm>
 #include <stdexcept>
+#include <sys/mman.h>
+#include <unistd.h>
 
 void bus_t::add_device(reg_t addr, abstract_device_t* dev)
 {
-  // Searching devices via lower_bound/upper_bound
-  // implicitly relies on the underlying std::map 
-  // container to sort the keys and provide ordered
-  // iteration over this sort, which it does. (python's
-  // SortedDict is a good analogy)
-  devices[addr] = dev;
+  devices[addr] = std::make_pair(dev, (mem_t*)NULL);
+  build_ranges();
 }
 
-bool bus_t::load(reg_t addr, size_t len, uint8_t* bytes)
+void bus_t::add_device(reg_t addr, mem_t* mem)
 {
-  // Find the device with the base address closest to but
-  // less than addr (price-is-right search)
-  auto it = devices.upper_bound(addr);
-  if (devices.empty() || it == devices.begin()) {
-    // Either the bus is empty, or there weren't 
-    // any items with a base address <= addr
-    return false;
+  devices[addr] = std::make_pair(mem, mem);
+  build_ranges();
+}
+
+void bus_t::build_ranges()
+{
+  // a device serves every address from its base up to the next device's
+  // base, as std::map keeps the devices sorted by base address
+  ranges.clear();
+  for (auto it = devices.begin(); it != devices.end(); ++it) {
+    auto next = std::next(it);
+    reg_t end = next == devices.end() ? reg_t(-1) : next->first - 1;
+    ranges.push_back({it->first, end, it->second.first, it->second.second});
   }
-  // Found at least one item with base address <= addr
-  // The iterator points to the device after this, so
-  // go back by one item.
-  it--;
-  return it->second->load(addr - it->first, len, bytes);
 }
 
-bool bus_t::store(reg_t addr, size_t len, const uint8_t* bytes)
+const bus_t::range_t* bus_t::find_range(reg_t addr, size_t* hint) const
 {
-  // See comments in bus_t::load
-  auto it = devices.upper_bound(addr);
-  if (devices.empty() || it == devices.begin()) {
-    return false;
+  if (hint && *hint < ranges.size()) {
+    const range_t* range = &ranges[*hint];
+    if (addr >= range->base && addr <= range->end)
+      return range;
   }
-  it--;
-  return it->second->store(addr - it->first, len, bytes);
+
+  // find the last range with a base address <= addr
+  auto it = std::upper_bound(ranges.begin(), ranges.end(), addr,
+                             [](reg_t addr, const range_t& range) { return addr < range.base; });
+  if (it == ranges.begin())
+    return NULL;
+  --it;
+  if (hint)
+    *hint = it - ranges.begin();
+  return &*it;
+}
+
+bool bus_t::load(reg_t addr, size_t len, uint8_t* bytes)
+{
+  const range_t* range = find_range(addr);
+  return range && range->dev->load(addr - range->base, len, bytes);
+}
+
+bool bus_t::store(reg_t addr, size_t len, const uint8_t* bytes)
+{
+  const range_t* range = find_range(addr);
+  return range && range->dev->store(addr - range->base, len, bytes);
 }
 
 std::pair<reg_t, abstract_device_t*> bus_t::find_device(reg_t addr)
 {
-  // See comments in bus_t::load
-  auto it = devices.upper_bound(addr);
-  if (devices.empty() || it == devices.begin()) {
+  const range_t* range = find_range(addr);
+  if (!range)
     return std::make_pair((reg_t)0, (abstract_device_t*)NULL);
-  }
-  it--;
-  return std::make_pair(it->first, it->second);
+  return std::make_pair(range->base, range->dev);
 }
 
 // Type for holding all registered MMIO plugins by name.
@@ -91,15 +109,25 @@ bool mmio_plugin_device_t::store(reg_t addr, size_t len, const uint8_t* bytes)
   return (*plugin.store)(user_data, addr, len, bytes);
 }
 
-mem_t::mem_t(reg_t size)
-  : sz(size)
+mem_t::mem_t(reg_t size, bool flat)
+  : flat_memory(NULL), sz(size)
 {
   if (size == 0 || size % PGSIZE != 0)
     throw std::runtime_error("memory size must be a positive multiple of 4 KiB");
+
+  if (flat) {
+    void* res = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (res == MAP_FAILED)
+      throw std::runtime_error("unable to reserve host memory for a flat memory region");
+    flat_memory = (char*)res;
+  }
 }
 
 mem_t::~mem_t()
 {
+  if (flat_memory)
+    munmap(flat_memory, sz);
   for (auto& entry : sparse_memory_map)
     free(entry.second);
 }
@@ -126,7 +154,11 @@ bool mem_t::load_store(reg_t addr, size_t len, uint8_t* bytes, bool store)
 }
 
 char* mem_t::contents(reg_t addr) {
+  if (flat_memory)
+    return flat_memory + addr;
+
   reg_t ppn = addr >> PGSHIFT, pgoff = addr % PGSIZE;
+  std::lock_guard<std::mutex> lock(sparse_memory_lock);
   auto search = sparse_memory_map.find(ppn);
   if (search == sparse_memory_map.end()) {
     auto res = (char*)calloc(PGSIZE, 1);
@@ -137,3 +169,59 @@ char* mem_t::contents(reg_t addr) {
   }
   return search->second + pgoff;
 }
+
+static bool page_is_zero(const char* page)
+{
+  for (reg_t i = 0; i < PGSIZE; i++)
+    if (page[i])
+      return false;
+  return true;
+}
+
+void mem_t::checkpoint(checkpoint_t& c)
+{
+  c.section("pages", sz);
+
+  // pages are stored as (offset, contents) records up to an offset of -1
+  const reg_t end = reg_t(-1);
+  if (c.restoring()) {
+    // harts hold pointers into the memory, so it is zeroed in place
+    if (flat_memory)
+      madvise(flat_memory, sz, MADV_DONTNEED);
+    for (auto& entry : sparse_memory_map)
+      memset(entry.second, 0, PGSIZE);
+
+    reg_t addr;
+    for (c.io(addr); addr != end; c.io(addr)) {
+      if (addr % PGSIZE != 0 || addr >= sz)
+        c.mismatch("page offset " + std::to_string(addr) + " is out of range");
+      c.io(contents(addr), PGSIZE);
+    }
+    return;
+  }
+
+  auto save_page = [&](reg_t addr, char* page) {
+    if (!page_is_zero(page)) {
+      c.io(addr);
+      c.io(page, PGSIZE);
+    }
+  };
+
+  if (flat_memory) {
+    // pages the host never populated are zero; skip them without reading
+    // them, which would populate them
+    size_t host_pgsize = sysconf(_SC_PAGESIZE);
+    std::vector<unsigned char> resident((sz + host_pgsize - 1) / host_pgsize);
+    if (mincore(flat_memory, sz, resident.data()) != 0)
+      std::fill(resident.begin(), resident.end(), 1);
+    for (reg_t addr = 0; addr < sz; addr += PGSIZE)
+      if (resident[addr / host_pgsize] & 1)
+        save_page(addr, flat_memory + addr);
+  } else {
+    for (auto& entry : sparse_memory_map)
+      save_page(entry.first << PGSHIFT, entry.second);
+  }
+
+  reg_t addr = end;
+  c.io(addr);
+}
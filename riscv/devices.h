@@ -6,21 +6,42 @@
 #include "abstract_device.h"
 #include "platform.h"
 #include <map>
+#include <mutex>
 #include <vector>
 #include <utility>
 
 class processor_t;
+class mem_t;
+class checkpoint_t;
 
 class bus_t : public abstract_device_t {
  public:
+  // the addresses from base to end (inclusive) are served by dev.  mem is
+  // dev if it was added as a memory, so that RAM is told from MMIO without
+  // RTTI.
+  struct range_t {
+    reg_t base;
+    reg_t end;
+    abstract_device_t* dev;
+    mem_t* mem;
+  };
+
   bool load(reg_t addr, size_t len, uint8_t* bytes);
   bool store(reg_t addr, size_t len, const uint8_t* bytes);
   void add_device(reg_t addr, abstract_device_t* dev);
+  void add_device(reg_t addr, mem_t* mem);
 
   std::pair<reg_t, abstract_device_t*> find_device(reg_t addr);
 
+  // returns the range containing addr, or NULL.  if hint is given, it holds
+  // the index of the range its owner (e.g. a hart) found last, which is
+  // checked before searching.
+  const range_t* find_range(reg_t addr, size_t* hint = NULL) const;
+
  private:
-  std::map<reg_t, abstract_device_t*> devices;
+  std::map<reg_t, std::pair<abstract_device_t*, mem_t*>> devices;
+  std::vector<range_t> ranges; // rebuilt from devices whenever one is added
+  void build_ranges();
 };
 
 class rom_device_t : public abstract_device_t {
@@ -35,7 +56,10 @@ class rom_device_t : public abstract_device_t {
 
 class mem_t : public abstract_device_t {
  public:
-  mem_t(reg_t size);
+  // a flat memory is a single host reservation, which the host only backs
+  // with pages once they are touched; otherwise pages are allocated on
+  // first use and looked up in a map.
+  mem_t(reg_t size, bool flat = false);
   mem_t(const mem_t& that) = delete;
   ~mem_t();
 
@@ -43,11 +67,18 @@ class mem_t : public abstract_device_t {
   bool store(reg_t addr, size_t len, const uint8_t* bytes) { return load_store(addr, len, const_cast<uint8_t*>(bytes), true); }
   char* contents(reg_t addr);
   reg_t size() { return sz; }
+  char* flat_contents() { return flat_memory; } // NULL unless flat
+
+  // save the pages that are not known to be zero, or zero the memory in
+  // place and restore them
+  void checkpoint(checkpoint_t& c);
 
  private:
   bool load_store(reg_t addr, size_t len, uint8_t* bytes, bool store);
 
+  char* flat_memory;
   std::map<reg_t, char*> sparse_memory_map;
+  std::mutex sparse_memory_lock; // harts may allocate pages concurrently
   reg_t sz;
 };
 
@@ -58,6 +89,7 @@ class clint_t : public abstract_device_t {
   bool store(reg_t addr, size_t len, const uint8_t* bytes);
   size_t size() { return CLINT_SIZE; }
   void increment(reg_t inc);
+  void checkpoint(checkpoint_t& c);
  private:
   typedef uint64_t mtime_t;
   typedef uint64_t mtimecmp_t;
@@ -2,6 +2,11 @@
 
 #include "processor.h"
 #include "mmu.h"
+#include "jit.h"
+#include "bbv.h"
+#include "insn_mix.h"
+#include "sample_profiler.h"
+#include "commit_log.h"
 #include "disasm.h"
 #include <cassert>
 
@@ -21,39 +26,6 @@ static void commit_log_stash_privilege(processor_t* p)
   state->last_inst_flen = p->get_flen();
 }
 
-static void commit_log_print_value(FILE *log_file, int width, const void *data)
-{
-  assert(log_file);
-
-  switch (width) {
-    case 8:
-      fprintf(log_file, "0x%01" PRIx8, *(const uint8_t *)data);
-      break;
-    case 16:
-      fprintf(log_file, "0x%04" PRIx16, *(const uint16_t *)data);
-      break;
-    case 32:
-      fprintf(log_file, "0x%08" PRIx32, *(const uint32_t *)data);
-      break;
-    case 64:
-      fprintf(log_file, "0x%016" PRIx64, *(const uint64_t *)data);
-      break;
-    default:
-      // max lengh of vector
-      if (((width - 1) & width) == 0) {
-        const uint64_t *arr = (const uint64_t *)data;
-
-        fprintf(log_file, "0x");
-        for (int idx = width / 64 - 1; idx >= 0; --idx) {
-          fprintf(log_file, "%016" PRIx64, arr[idx]);
-        }
-      } else {
-        abort();
-      }
-      break;
-  }
-}
-
 static void commit_log_print_value(FILE *log_file, int width, uint64_t val)
 {
   commit_log_print_value(log_file, width, &val);
@@ -66,6 +38,11 @@ const char* processor_t::get_symbol(uint64_t addr)
 
 static void commit_log_print_insn(processor_t *p, reg_t pc, insn_t insn)
 {
+  if (commit_log_ring_t* ring = p->get_commit_log_ring()) {
+    ring->record(p, pc, insn);
+    return;
+  }
+
   FILE *log_file = p->get_log_file();
 
   auto& reg = p->get_state()->log_reg_write;
@@ -160,16 +137,11 @@ static void commit_log_stash_privilege(processor_t* p) {}
 static void commit_log_print_insn(processor_t* p, reg_t pc, insn_t insn) {}
 #endif
 
-inline void processor_t::update_histogram(reg_t pc)
-{
-#ifdef RISCV_ENABLE_HISTOGRAM
-  pc_histogram[pc]++;
-#endif
-}
-
 // This is expected to be inlined by the compiler so each use of execute_insn
 // includes a duplicated body of the function to get separate fetch.func
-// function calls.
+// function calls.  The instantiation with profile set also reports each
+// instruction to the hart's profilers.
+template<bool profile>
 static inline reg_t execute_insn(processor_t* p, reg_t pc, insn_fetch_t fetch)
 {
   commit_log_reset(p);
@@ -177,8 +149,14 @@ static inline reg_t execute_insn(processor_t* p, reg_t pc, insn_fetch_t fetch)
   reg_t npc;
 
   try {
+    if constexpr (profile)
+      p->get_profilers().issue(p, pc, fetch.insn);
     npc = fetch.func(p, fetch.insn, pc);
     if (npc != PC_SERIALIZE_BEFORE) {
+      if constexpr (profile) {
+        reg_t next_pc = npc == PC_SERIALIZE_AFTER ? p->get_state()->pc : npc;
+        p->get_profilers().retire(p, pc, fetch.insn, next_pc);
+      }
 
 #ifdef RISCV_ENABLE_COMMITLOG
       if (p->get_log_commits_enabled()) {
@@ -208,11 +186,77 @@ static inline reg_t execute_insn(processor_t* p, reg_t pc, insn_fetch_t fetch)
   } catch(...) {
     throw;
   }
-  p->update_histogram(pc);
 
   return npc;
 }
 
+// the profiled instantiations are kept out of line, so that they do not
+// weigh on the code of the unprofiled interpreter loop
+static NOINLINE reg_t execute_insn_profiled(processor_t* p, reg_t pc, insn_fetch_t fetch)
+{
+  return execute_insn<true>(p, pc, fetch);
+}
+
+// for the slow paths, which pick the instantiation per instruction
+static inline reg_t execute_insn(processor_t* p, reg_t pc, insn_fetch_t fetch)
+{
+  if (likely(p->get_profilers().empty()))
+    return execute_insn<false>(p, pc, fetch);
+  return execute_insn_profiled(p, pc, fetch);
+}
+
+// Runs the instructions of block from the i-th on, stopping after the len-th
+// or at one that leaves the block, reporting them to the hart's profilers if
+// profile is set, counting them in its instruction mix and sampler if it has
+// them, and tracing their fetches if memtracers are attached.  Returns the pc
+// the last one went on to, and counts all but the last in instret.
+template<bool profile>
+static NOINLINE reg_t execute_block_observed(processor_t* p, insn_block_t* block, size_t i,
+                                             size_t len, reg_t pc, size_t& instret)
+{
+  insn_mix_t* mix = p->get_insn_mix();
+  hart_sampler_t* sampler = p->get_sampler();
+  mmu_t* mmu = p->get_mmu();
+  bool tracing = mmu->is_tracing();
+  unsigned mode = insn_mix_t::mode_index(p->get_state()->prv, p->get_state()->v);
+  reg_t block_pc = pc;
+  size_t first = i;
+
+  // the first n instructions from the i-th retired, and went on to npc
+  auto retired = [&](size_t n, reg_t npc) {
+    if (mix)
+      mix->record(block->mix_id, block_pc, block->insns, block->len, n, mode);
+    if (sampler)
+      sampler->record(p, block_pc, block->insns + first, n, npc);
+  };
+
+  try {
+    for ( ; ; ) {
+      if (tracing) {
+        // the instructions of a block are contiguous in physical memory
+        insn_bits_t bits = block->insns[i].insn.bits();
+        mmu->trace_access(block->paddr + (pc - block->tag), insn_length(bits), FETCH);
+      }
+      pc = execute_insn<profile>(p, pc, block->insns[i]);
+      if (unlikely(++i == len || invalid_pc(pc)))
+        break;
+      instret++;
+      p->get_state()->pc = pc;
+    }
+  } catch (wait_for_interrupt_t&) {
+    // a wfi retires before the hart waits
+    retired(i - first + 1, p->get_state()->pc);
+    throw;
+  } catch (...) {
+    // the instruction that threw did not retire
+    retired(i - first, p->get_state()->pc);
+    throw;
+  }
+
+  retired(i - first - (pc == PC_SERIALIZE_BEFORE), pc);
+  return pc;
+}
+
 bool processor_t::slow_path()
 {
   return debug || state.single_step != state.STEP_NONE || state.debug_mode;
@@ -276,23 +320,64 @@ void processor_t::step(size_t n)
           insn_fetch_t fetch = mmu->load_insn(pc);
           if (debug && !state.serialized)
             disasm(fetch.insn);
+          if (unlikely(bbv != NULL)) {
+            // off the fast path, each instruction counts as a block
+            uint32_t id = 0;
+            bbv->record(id, pc, 1);
+          }
+          reg_t insn_pc = pc;
+          unsigned mode = insn_mix_t::mode_index(state.prv, state.v);
           pc = execute_insn(this, pc, fetch);
+          if (unlikely(insn_mix != NULL) && pc != PC_SERIALIZE_BEFORE) {
+            uint32_t id = 0;
+            insn_mix->record(id, insn_pc, &fetch, 1, 1, mode);
+          }
+          if (unlikely(sampler != NULL) && pc != PC_SERIALIZE_BEFORE)
+            sampler->record(this, insn_pc, &fetch, 1, pc);
           advance_pc();
         }
       }
       else while (instret < n)
       {
-        // Main simulation loop, fast path.
-        for (auto ic_entry = _mmu->access_icache(pc); ; ) {
-          auto fetch = ic_entry->data;
-          pc = execute_insn(this, pc, fetch);
-          ic_entry = ic_entry->next;
-          if (unlikely(ic_entry->tag != pc))
-            break;
-          if (unlikely(instret + 1 == n))
-            break;
-          instret++;
+        // Main simulation loop, fast path.  Runs one cached basic block per
+        // iteration, so the block cache tag is only checked on block entry.
+        auto block = _mmu->access_block_cache(pc);
+        size_t len = std::min(block->len, n - instret);
+        if (unlikely(bbv != NULL))
+          bbv->record(block->bbv_id, pc, len);
+        size_t i = 0;
+        if (unlikely(jit != NULL) && len == block->len && profilers.empty() && !insn_mix && !sampler &&
+            !_mmu->is_tracing()) {
+          // translated code retires a prefix of the block; the interpreter
+          // runs the rest, starting with whatever the translation left off at.
+          i = jit->execute(block);
+          pc += 4 * i;
+          instret += i;
           state.pc = pc;
+          if (i == len)
+            continue;
+        }
+        if (unlikely(!profilers.empty() || insn_mix != NULL || sampler != NULL ||
+                     _mmu->is_tracing())) {
+          // the observed loop is out of line, so if an instruction in it
+          // traps, pc must be brought up to it, as the loop below keeps it
+          try {
+            if (!profilers.empty())
+              pc = execute_block_observed<true>(this, block, i, len, pc, instret);
+            else
+              pc = execute_block_observed<false>(this, block, i, len, pc, instret);
+          } catch (...) {
+            pc = state.pc;
+            throw;
+          }
+        } else {
+          for ( ; ; ) {
+            pc = execute_insn<false>(this, pc, block->insns[i]);
+            if (unlikely(++i == len || invalid_pc(pc)))
+              break;
+            instret++;
+            state.pc = pc;
+          }
         }
 
         advance_pc();
@@ -358,4 +443,8 @@ void processor_t::step(size_t n)
 
     n -= instret;
   }
+
+  // the other harts may share the memtracers, so hand them this one's
+  // accesses before they run
+  mmu->flush_trace();
 }
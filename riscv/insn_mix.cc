@@ -0,0 +1,137 @@
+// See LICENSE for license details.
+
+#include "insn_mix.h"
+#include "processor.h"
+#include "disasm.h"
+#include <inttypes.h>
+#include <algorithm>
+
+static const char* const mode_names[insn_mix_t::MODES] = {
+  "U", "S", "M", "VU", "VS"
+};
+
+insn_mix_t::insn_mix_t(processor_t* proc, bool by_mode)
+  : proc(proc), by_mode(by_mode), modes(by_mode ? MODES : 1), blocks(1),
+    runs(modes * MAX_BLOCK_INSNS)
+{
+}
+
+uint32_t insn_mix_t::block_id(reg_t pc, insn_fetch_t* insns, size_t len)
+{
+  // a block seen before will do if it starts with the same instructions.
+  // there can be several at a pc, e.g. in different address spaces.
+  auto range = ids.equal_range(pc);
+  for (auto it = range.first; it != range.second; ++it) {
+    const block_t& block = blocks[it->second];
+    bool same = block.len >= len;
+    for (size_t i = 0; same && i < len; i++)
+      same = block.bits[i] == insns[i].insn.bits();
+    if (same)
+      return it->second;
+  }
+
+  uint32_t id = blocks.size();
+  block_t block = {pc, len};
+  for (size_t i = 0; i < len; i++) {
+    block.ids[i] = proc->get_insn_id(insns[i].insn);
+    block.bits[i] = insns[i].insn.bits();
+  }
+  blocks.push_back(block);
+  runs.resize(blocks.size() * modes * MAX_BLOCK_INSNS);
+  ids.emplace(pc, id);
+  return id;
+}
+
+void insn_mix_t::insn_counts(uint32_t id, unsigned mode, uint64_t* counts)
+{
+  // the i-th instruction ran in every run of more than i instructions
+  const uint64_t* block_runs = &runs[(id * modes + mode) * MAX_BLOCK_INSNS];
+  uint64_t sum = 0;
+  for (size_t i = blocks[id].len; i-- > 0; )
+    counts[i] = sum += block_runs[i];
+}
+
+void insn_mix_t::print_mix()
+{
+  // counts by instruction id and mode, and an encoding of each instruction
+  std::vector<uint64_t> totals;
+  std::vector<insn_bits_t> encodings;
+  std::vector<uint64_t> mode_totals(modes);
+  uint64_t total = 0;
+  for (uint32_t id = 1; id < blocks.size(); id++) {
+    const block_t& block = blocks[id];
+    for (unsigned mode = 0; mode < modes; mode++) {
+      uint64_t counts[MAX_BLOCK_INSNS];
+      insn_counts(id, mode, counts);
+      for (size_t i = 0; i < block.len; i++) {
+        if (counts[i] == 0)
+          continue;
+        uint32_t insn_id = block.ids[i];
+        if (insn_id >= encodings.size()) {
+          encodings.resize(insn_id + 1);
+          totals.resize((insn_id + 1) * modes);
+        }
+        encodings[insn_id] = block.bits[i];
+        totals[insn_id * modes + mode] += counts[i];
+        mode_totals[mode] += counts[i];
+        total += counts[i];
+      }
+    }
+  }
+
+  std::vector<std::pair<uint64_t, uint32_t>> order;
+  for (uint32_t id = 0; id < encodings.size(); id++) {
+    uint64_t count = 0;
+    for (unsigned mode = 0; mode < modes; mode++)
+      count += totals[id * modes + mode];
+    if (count)
+      order.push_back(std::make_pair(count, id));
+  }
+  std::sort(order.begin(), order.end(), [](const std::pair<uint64_t, uint32_t>& a,
+                                          const std::pair<uint64_t, uint32_t>& b) {
+    return a.first != b.first ? a.first > b.first : a.second < b.second;
+  });
+
+  for (auto& entry : order) {
+    const disasm_insn_t* disasm = proc->get_disassembler()->lookup(encodings[entry.second]);
+    printf("Mix%u %-16s %14" PRIu64 " (%7.3f%%)", proc->get_id(),
+           disasm ? disasm->get_name() : "unknown", entry.first, 100.0 * entry.first / total);
+    if (by_mode) {
+      for (unsigned mode = 0; mode < modes; mode++)
+        if (mode_totals[mode])
+          printf("  %s: %14" PRIu64, mode_names[mode], totals[entry.second * modes + mode]);
+    }
+    printf("\n");
+  }
+}
+
+void insn_mix_t::print_pc_histogram(FILE* out)
+{
+  std::unordered_map<reg_t, uint64_t> pcs;
+  for (uint32_t id = 1; id < blocks.size(); id++) {
+    const block_t& block = blocks[id];
+    reg_t pc = block.pc;
+    uint64_t counts[MAX_BLOCK_INSNS] = {0};
+    for (unsigned mode = 0; mode < modes; mode++) {
+      uint64_t mode_counts[MAX_BLOCK_INSNS];
+      insn_counts(id, mode, mode_counts);
+      for (size_t i = 0; i < block.len; i++)
+        counts[i] += mode_counts[i];
+    }
+    for (size_t i = 0; i < block.len; i++) {
+      if (counts[i])
+        pcs[pc] += counts[i];
+      pc += insn_length(block.bits[i]);
+    }
+  }
+
+  std::vector<std::pair<reg_t, uint64_t>> order(pcs.begin(), pcs.end());
+  std::sort(order.begin(), order.end(), [](const std::pair<reg_t, uint64_t>& a,
+                                          const std::pair<reg_t, uint64_t>& b) {
+    return a.second != b.second ? a.second > b.second : a.first < b.first;
+  });
+
+  fprintf(out, "PC Histogram size:%zu\n", order.size());
+  for (auto& entry : order)
+    fprintf(out, "%0" PRIx64 " %" PRIu64 "\n", entry.first, entry.second);
+}
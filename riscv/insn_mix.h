@@ -0,0 +1,69 @@
+// See LICENSE for license details.
+
+#ifndef _RISCV_INSN_MIX_H
+#define _RISCV_INSN_MIX_H
+
+#include "mmu.h"
+#include <stdio.h>
+#include <unordered_map>
+#include <vector>
+
+// Counts the instructions a hart executes, for its dynamic instruction mix
+// (--insn-mix) and PC histogram (-g).  Rather than counting every instruction,
+// it counts how often each cached block ran for how many instructions, in
+// a flat array, so that the interpreter pays one increment per block.  The
+// counts per instruction, which are indexed by the compact ids the hart
+// assigns to its instructions, and per pc are worked out from the blocks
+// when they are printed.
+class insn_mix_t
+{
+public:
+  // by_mode splits the instruction mix by privilege mode
+  insn_mix_t(processor_t* proc, bool by_mode);
+
+  // count a run of the first n of the len instructions at pc, in the mode
+  // of mode_index().  id caches the block's number for the caller; it starts
+  // out as 0.
+  void record(uint32_t& id, reg_t pc, insn_fetch_t* insns, size_t len,
+              size_t n, unsigned mode)
+  {
+    if (unlikely(id == 0))
+      id = block_id(pc, insns, len);
+    if (likely(n != 0))
+      runs[(id * modes + (by_mode ? mode : 0)) * MAX_BLOCK_INSNS + n - 1]++;
+  }
+
+  static const unsigned MODES = 5; // U, S, M, VU and VS
+  static unsigned mode_index(reg_t prv, bool virt)
+  {
+    return virt ? 3 + (prv == PRV_S) : prv == PRV_M ? 2 : prv;
+  }
+
+  // print the executed instructions, most frequent first
+  void print_mix();
+  // print the pcs and how often each ran, most frequent first
+  void print_pc_histogram(FILE* out);
+
+private:
+  // the instructions of a cached block, as first seen
+  struct block_t {
+    reg_t pc;
+    size_t len;
+    uint32_t ids[MAX_BLOCK_INSNS];
+    insn_bits_t bits[MAX_BLOCK_INSNS];
+  };
+
+  processor_t* proc;
+  bool by_mode;
+  unsigned modes; // MODES if by_mode, else 1
+  std::vector<block_t> blocks; // by block number; 0 is unused
+  std::vector<uint64_t> runs; // by block number, mode and instructions run - 1
+  std::unordered_multimap<reg_t, uint32_t> ids; // block numbers by pc
+
+  uint32_t block_id(reg_t pc, insn_fetch_t* insns, size_t len);
+
+  // the number of times each instruction of block id ran in mode
+  void insn_counts(uint32_t id, unsigned mode, uint64_t* counts);
+};
+
+#endif
@@ -6,4 +6,4 @@ if (STATE.v) {
 } else {
   require_privilege(get_field(STATE.mstatus->read(), MSTATUS_TVM) ? PRV_M : PRV_S);
 }
-MMU.flush_tlb();
+MMU.flush_tlb_vma(STATE.v, insn.rs1() != 0, RS1, insn.rs2() != 0, RS2);
@@ -0,0 +1,387 @@
+// See LICENSE for license details.
+
+#include "jit.h"
+#include "processor.h"
+#include "mmu.h"
+#include <cstring>
+#include <initializer_list>
+#include <sys/mman.h>
+
+#if defined(__x86_64__)
+
+// host registers: rbx holds the guest register file, r12 the mmu_t.
+// rax, rcx, rdx and rsi are scratch; r13 is only saved to keep the stack
+// aligned across helper calls.
+enum { RAX = 0, RCX = 1, RDX = 2, RBX = 3, RSI = 6, RDI = 7 };
+
+static char* load_host_addr(mmu_t* mmu, reg_t addr)
+{
+  return mmu->fast_load_host_addr(addr);
+}
+
+static char* store_host_addr(mmu_t* mmu, reg_t addr)
+{
+  return mmu->fast_store_host_addr(addr);
+}
+
+class x86_emitter_t
+{
+public:
+  std::vector<uint8_t> buf;
+  // (offset of a rel32 to patch, number of instructions retired on exit)
+  std::vector<std::pair<size_t, size_t>> exits;
+
+  void b(uint8_t x) { buf.push_back(x); }
+  void b(std::initializer_list<uint8_t> xs) { buf.insert(buf.end(), xs); }
+  void d32(uint32_t x) { for (int i = 0; i < 4; i++) b(x >> (8 * i)); }
+  void d64(uint64_t x) { for (int i = 0; i < 8; i++) b(x >> (8 * i)); }
+
+  // op reg, [rbx + 8 * xr] (or the reverse direction, depending on op)
+  void xreg_op(std::initializer_list<uint8_t> op, int reg, unsigned xr, bool wide = true)
+  {
+    if (wide)
+      b(0x48);
+    b(op);
+    b(0x80 | (reg << 3) | RBX);
+    d32(xr * sizeof(reg_t));
+  }
+  void load_xreg(int reg, unsigned xr) { xreg_op({0x8b}, reg, xr); }
+  void store_rax(unsigned xr) { if (xr != 0) xreg_op({0x89}, RAX, xr); }
+
+  // op rax, imm32 for the 0x81 group (add, or, and, sub, xor, cmp)
+  void alu_imm(int ext, int32_t imm, bool wide = true)
+  {
+    if (wide)
+      b(0x48);
+    b({0x81, uint8_t(0xc0 | (ext << 3))});
+    d32(imm);
+  }
+  // shl/shr/sar rax, imm8 or by cl
+  void shift_imm(int ext, unsigned shamt, bool wide = true)
+  {
+    if (wide)
+      b(0x48);
+    b({0xc1, uint8_t(0xc0 | (ext << 3)), uint8_t(shamt)});
+  }
+  void shift_cl(int ext, bool wide = true)
+  {
+    if (wide)
+      b(0x48);
+    b({0xd3, uint8_t(0xc0 | (ext << 3))});
+  }
+  void setcc_rax(uint8_t cc) { b({0x0f, cc, 0xc0, 0x0f, 0xb6, 0xc0}); }
+  void movsxd_rax() { b({0x48, 0x63, 0xc0}); }
+  void mov_rax_imm(int64_t imm)
+  {
+    if (imm == int32_t(imm)) {
+      b({0x48, 0xc7, 0xc0});
+      d32(imm);
+    } else {
+      b({0x48, 0xb8});
+      d64(imm);
+    }
+  }
+
+  // leave the translation, reporting retired instructions, if cc holds
+  void exit_if(uint8_t jcc, size_t retired)
+  {
+    b({0x0f, jcc});
+    exits.push_back(std::make_pair(buf.size(), retired));
+    d32(0);
+  }
+
+  void prologue()
+  {
+    b({0x53, 0x41, 0x54, 0x41, 0x55});  // push rbx; push r12; push r13
+    b({0x48, 0x89, 0xfb});              // mov rbx, rdi
+    b({0x49, 0x89, 0xf4});              // mov r12, rsi
+  }
+  void epilogue(size_t retired)
+  {
+    b(0xb8);                            // mov eax, retired
+    d32(retired);
+    b({0x41, 0x5d, 0x41, 0x5c, 0x5b, 0xc3});  // pop r13; pop r12; pop rbx; ret
+  }
+
+  // rax = host address of [rs1 + imm], or exit if it misses the TLB fast path
+  void host_addr(unsigned rs1, int32_t imm, size_t size, char* (*helper)(mmu_t*, reg_t), size_t retired)
+  {
+    load_xreg(RSI, rs1);
+    b({0x48, 0x81, 0xc6});              // add rsi, imm32
+    d32(imm);
+    b({0xf7, 0xc6});                    // test esi, size - 1
+    d32(size - 1);
+    exit_if(0x85, retired);             // jnz
+    b({0x4c, 0x89, 0xe7});              // mov rdi, r12
+    b({0x48, 0xb8});                    // mov rax, helper
+    d64(reinterpret_cast<uint64_t>(helper));
+    b({0xff, 0xd0});                    // call rax
+    b({0x48, 0x85, 0xc0});              // test rax, rax
+    exit_if(0x84, retired);             // jz
+  }
+
+  void finish(size_t retired)
+  {
+    epilogue(retired);
+    for (auto& e : exits) {
+      size_t stub = buf.size();
+      epilogue(e.second);
+      int32_t rel = stub - (e.first + 4);
+      for (int i = 0; i < 4; i++)
+        buf[e.first + i] = rel >> (8 * i);
+    }
+  }
+};
+
+enum { EXT_ADD = 0, EXT_OR = 1, EXT_AND = 4, EXT_SUB = 5, EXT_XOR = 6, EXT_CMP = 7 };
+enum { EXT_SHL = 4, EXT_SHR = 5, EXT_SAR = 7 };
+enum { CC_B = 0x92, CC_L = 0x9c };
+
+// emit one instruction; returns false if it is not covered by the JIT
+static bool emit_insn(x86_emitter_t& e, insn_t insn, reg_t pc, size_t index, bool mul_ok)
+{
+  unsigned rd = insn.rd(), rs1 = insn.rs1(), rs2 = insn.rs2();
+  unsigned funct3 = (insn.bits() >> 12) & 7, funct7 = insn.bits() >> 25;
+  int32_t imm = insn.i_imm();
+
+  switch (insn.bits() & 0x7f) {
+    case 0x37:  // lui
+      e.mov_rax_imm(insn.u_imm());
+      e.store_rax(rd);
+      return true;
+
+    case 0x17:  // auipc
+      e.mov_rax_imm(pc + insn.u_imm());
+      e.store_rax(rd);
+      return true;
+
+    case 0x13:  // op-imm
+      e.load_xreg(RAX, rs1);
+      switch (funct3) {
+        case 0: e.alu_imm(EXT_ADD, imm); break;
+        case 2: e.alu_imm(EXT_CMP, imm); e.setcc_rax(CC_L); break;
+        case 3: e.alu_imm(EXT_CMP, imm); e.setcc_rax(CC_B); break;
+        case 4: e.alu_imm(EXT_XOR, imm); break;
+        case 6: e.alu_imm(EXT_OR, imm); break;
+        case 7: e.alu_imm(EXT_AND, imm); break;
+        case 1:
+          if ((funct7 >> 1) != 0)
+            return false;
+          e.shift_imm(EXT_SHL, insn.shamt());
+          break;
+        case 5:
+          if ((funct7 >> 1) == 0)
+            e.shift_imm(EXT_SHR, insn.shamt());
+          else if ((funct7 >> 1) == 0x10)
+            e.shift_imm(EXT_SAR, insn.shamt());
+          else
+            return false;
+          break;
+      }
+      e.store_rax(rd);
+      return true;
+
+    case 0x1b:  // op-imm-32
+      e.load_xreg(RAX, rs1);
+      if (funct3 == 0)
+        e.alu_imm(EXT_ADD, imm, false);
+      else if (funct3 == 1 && funct7 == 0)
+        e.shift_imm(EXT_SHL, rs2, false);
+      else if (funct3 == 5 && funct7 == 0)
+        e.shift_imm(EXT_SHR, rs2, false);
+      else if (funct3 == 5 && funct7 == 0x20)
+        e.shift_imm(EXT_SAR, rs2, false);
+      else
+        return false;
+      e.movsxd_rax();
+      e.store_rax(rd);
+      return true;
+
+    case 0x33:  // op
+      if (funct7 == 1) {
+        if (!mul_ok || (funct3 != 0 && funct3 != 1 && funct3 != 3))
+          return false;
+        e.load_xreg(RAX, rs1);
+        if (funct3 == 0) {
+          e.xreg_op({0x0f, 0xaf}, RAX, rs2);  // imul rax, [rs2]
+        } else {
+          e.xreg_op({0xf7}, funct3 == 1 ? 5 : 4, rs2);  // imul/mul [rs2]
+          e.b({0x48, 0x89, 0xd0});  // mov rax, rdx
+        }
+        e.store_rax(rd);
+        return true;
+      }
+      if (funct7 != 0 && !(funct7 == 0x20 && (funct3 == 0 || funct3 == 5)))
+        return false;
+      e.load_xreg(RAX, rs1);
+      switch (funct3) {
+        case 0: e.xreg_op({uint8_t(funct7 ? 0x2b : 0x03)}, RAX, rs2); break;
+        case 2: e.xreg_op({0x3b}, RAX, rs2); e.setcc_rax(CC_L); break;
+        case 3: e.xreg_op({0x3b}, RAX, rs2); e.setcc_rax(CC_B); break;
+        case 4: e.xreg_op({0x33}, RAX, rs2); break;
+        case 6: e.xreg_op({0x0b}, RAX, rs2); break;
+        case 7: e.xreg_op({0x23}, RAX, rs2); break;
+        case 1:
+        case 5:
+          e.xreg_op({0x8b}, RCX, rs2, false);
+          e.shift_cl(funct3 == 1 ? EXT_SHL : funct7 ? EXT_SAR : EXT_SHR);
+          break;
+      }
+      e.store_rax(rd);
+      return true;
+
+    case 0x3b:  // op-32
+      if (funct7 == 1) {
+        if (!mul_ok || funct3 != 0)
+          return false;
+        e.load_xreg(RAX, rs1);
+        e.xreg_op({0x0f, 0xaf}, RAX, rs2, false);  // imul eax, [rs2]
+      } else if (funct3 == 0 && (funct7 == 0 || funct7 == 0x20)) {
+        e.load_xreg(RAX, rs1);
+        e.xreg_op({uint8_t(funct7 ? 0x2b : 0x03)}, RAX, rs2, false);
+      } else if ((funct3 == 1 && funct7 == 0) || (funct3 == 5 && (funct7 == 0 || funct7 == 0x20))) {
+        e.load_xreg(RAX, rs1);
+        e.xreg_op({0x8b}, RCX, rs2, false);
+        e.shift_cl(funct3 == 1 ? EXT_SHL : funct7 ? EXT_SAR : EXT_SHR, false);
+      } else {
+        return false;
+      }
+      e.movsxd_rax();
+      e.store_rax(rd);
+      return true;
+
+    case 0x03: {  // load
+      static const uint8_t ops[7][4] = {
+        {0x48, 0x0f, 0xbe, 0x00},  // movsx rax, byte [rax]
+        {0x48, 0x0f, 0xbf, 0x00},  // movsx rax, word [rax]
+        {0x48, 0x63, 0x00},        // movsxd rax, dword [rax]
+        {0x48, 0x8b, 0x00},        // mov rax, [rax]
+        {0x0f, 0xb6, 0x00},        // movzx eax, byte [rax]
+        {0x0f, 0xb7, 0x00},        // movzx eax, word [rax]
+        {0x8b, 0x00},              // mov eax, [rax]
+      };
+      static const uint8_t lens[7] = {4, 4, 3, 3, 3, 3, 2};
+      if (funct3 == 7)
+        return false;
+      e.host_addr(rs1, imm, 1 << (funct3 & 3), load_host_addr, index);
+      e.buf.insert(e.buf.end(), ops[funct3], ops[funct3] + lens[funct3]);
+      e.store_rax(rd);
+      return true;
+    }
+
+    case 0x23: {  // store
+      if (funct3 > 3)
+        return false;
+      e.host_addr(rs1, insn.s_imm(), 1 << funct3, store_host_addr, index);
+      e.load_xreg(RCX, rs2);
+      switch (funct3) {
+        case 0: e.b({0x88, 0x08}); break;        // mov [rax], cl
+        case 1: e.b({0x66, 0x89, 0x08}); break;  // mov [rax], cx
+        case 2: e.b({0x89, 0x08}); break;        // mov [rax], ecx
+        case 3: e.b({0x48, 0x89, 0x08}); break;  // mov [rax], rcx
+      }
+      return true;
+    }
+  }
+
+  return false;
+}
+
+bool jit_t::supported()
+{
+  return true;
+}
+
+#else
+
+bool jit_t::supported()
+{
+  return false;
+}
+
+#endif
+
+// marks blocks that have been found not to be worth translating
+static size_t untranslatable(reg_t* xpr, mmu_t* mmu)
+{
+  return 0;
+}
+
+jit_t::jit_t(processor_t* proc)
+  : proc(proc), code_base(NULL), code_size(0), code_used(0)
+{
+  xpr = const_cast<reg_t*>(&proc->get_state()->XPR[0]);
+
+  void* p = mmap(NULL, CODE_SIZE, PROT_READ | PROT_WRITE | PROT_EXEC,
+                 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (p != MAP_FAILED) {
+    code_base = (uint8_t*)p;
+    code_size = CODE_SIZE;
+  }
+}
+
+jit_t::~jit_t()
+{
+  if (code_base)
+    munmap(code_base, code_size);
+}
+
+void jit_t::reset()
+{
+  // every translation hangs off a block cache entry, so dropping the
+  // blocks drops all references into the code buffer
+  proc->get_mmu()->flush_icache();
+  code_used = 0;
+}
+
+void jit_t::translate(insn_block_t* block)
+{
+  block->jit_code = untranslatable;
+
+#if defined(__x86_64__)
+  if (!code_base || proc->get_mmu()->is_target_big_endian())
+    return;
+
+  bool mul_ok = proc->extension_enabled('M') || proc->extension_enabled(EXT_ZMMUL);
+  x86_emitter_t e;
+  e.prologue();
+
+  size_t n = 0;
+  reg_t pc = block->tag;
+  for ( ; n < block->len; n++) {
+    insn_t insn = block->insns[n].insn;
+    size_t mark = e.buf.size();
+    if (insn.length() != 4 || !emit_insn(e, insn, pc, n, mul_ok)) {
+      e.buf.resize(mark);
+      break;
+    }
+    pc += 4;
+  }
+
+  // not worth the call overhead
+  if (n < 2)
+    return;
+
+  e.finish(n);
+  if (code_used + e.buf.size() > code_size)
+    reset();
+  if (e.buf.size() > code_size)
+    return;
+
+  uint8_t* code = code_base + code_used;
+  memcpy(code, e.buf.data(), e.buf.size());
+  code_used += e.buf.size();
+  block->jit_code = reinterpret_cast<jit_code_t>(code);
+#endif
+}
+
+size_t jit_t::execute(insn_block_t* block)
+{
+  if (unlikely(!block->jit_code)) {
+    if (++block->jit_hits < HOT_THRESHOLD)
+      return 0;
+    translate(block);
+  }
+
+  return block->jit_code(xpr, proc->get_mmu());
+}
@@ -0,0 +1,51 @@
+// See LICENSE for license details.
+
+#ifndef _RISCV_JIT_H
+#define _RISCV_JIT_H
+
+#include "decode.h"
+#include <vector>
+
+class processor_t;
+class mmu_t;
+struct insn_block_t;
+
+// Translates hot basic blocks of RV64I/M code to native x86-64 code.
+//
+// A translation covers the longest prefix of a block made of integer
+// register/immediate arithmetic, multiplies and aligned loads and stores;
+// control transfers and everything else are left to the interpreter.  A load
+// or store that misses the TLB fast path (including misaligned accesses,
+// trigger-checked and traced pages) leaves the translated code before it
+// changes any state, so the interpreter re-executes it and takes any trap
+// precisely.  Translated code returns how many instructions it retired, and
+// the caller accounts for them in minstret exactly as for interpreted ones.
+class jit_t
+{
+public:
+  jit_t(processor_t* proc);
+  ~jit_t();
+
+  // whether native code can be generated for this host
+  static bool supported();
+
+  // run the translation of block, translating it first once it is hot.
+  // returns the number of instructions retired, which may be zero.
+  size_t execute(insn_block_t* block);
+
+private:
+  processor_t* proc;
+  reg_t* xpr;
+
+  uint8_t* code_base;
+  size_t code_size;
+  size_t code_used;
+
+  static const size_t CODE_SIZE = 16 << 20;
+  static const unsigned HOT_THRESHOLD = 64;
+
+  void translate(insn_block_t* block);
+  void reset();
+};
+
+#endif
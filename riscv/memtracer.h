@@ -5,6 +5,7 @@
 
 #include <cstdint>
 #include <string.h>
+#include <algorithm>
 #include <vector>
 
 enum access_type {
@@ -13,6 +14,17 @@ enum access_type {
   FETCH,
 };
 
+// a run of memory accesses, in the order they were made, as parallel
+// arrays so that a tracer can go through one field of many accesses at once
+struct memtrace_batch_t {
+  size_t size;
+  const uint64_t* addrs; // physical
+  const uint32_t* bytes;
+  const uint8_t* types; // access_type
+  const uint32_t* harts; // id of the hart that made the access
+  const uint64_t* pcs; // of the instruction that made the access
+};
+
 class memtracer_t
 {
  public:
@@ -22,6 +34,18 @@ class memtracer_t
   virtual bool interested_in_range(uint64_t begin, uint64_t end, access_type type) = 0;
   virtual void trace(uint64_t addr, size_t bytes, access_type type) = 0;
   virtual void clean_invalidate(uint64_t addr, size_t bytes, bool clean, bool inval) = 0;
+
+  // the harts hand their accesses to the tracers in batches.  a tracer that
+  // can take many at once overrides this; by default, the accesses the
+  // tracer is interested in go to trace() one at a time.
+  virtual void trace_batch(const memtrace_batch_t& batch)
+  {
+    for (size_t i = 0; i < batch.size; i++) {
+      access_type type = access_type(batch.types[i]);
+      if (interested_in_range(batch.addrs[i], batch.addrs[i] + batch.bytes[i], type))
+        trace(batch.addrs[i], batch.bytes[i], type);
+    }
+  }
 };
 
 class memtracer_list_t : public memtracer_t
@@ -40,6 +64,25 @@ class memtracer_list_t : public memtracer_t
     for (auto it: list)
       it->trace(addr, bytes, type);
   }
+  void trace_batch(const memtrace_batch_t& batch)
+  {
+    if (list.size() == 1) {
+      list[0]->trace_batch(batch);
+      return;
+    }
+
+    // hand each run of accesses of one type to the tracers in turn, so that
+    // tracers of different types, e.g. an instruction and a data cache that
+    // share an L2, see the accesses in the order they were made
+    for (size_t begin = 0, end; begin < batch.size; begin = end) {
+      for (end = begin + 1; end < batch.size && batch.types[end] == batch.types[begin]; end++)
+        ;
+      memtrace_batch_t run = {end - begin, batch.addrs + begin, batch.bytes + begin,
+                              batch.types + begin, batch.harts + begin, batch.pcs + begin};
+      for (auto it: list)
+        it->trace_batch(run);
+    }
+  }
   void clean_invalidate(uint64_t addr, size_t bytes, bool clean, bool inval)
   {
     for (auto it: list)
@@ -49,6 +92,10 @@ class memtracer_list_t : public memtracer_t
   {
     list.push_back(h);
   }
+  void unhook(memtracer_t* h)
+  {
+    list.erase(std::remove(list.begin(), list.end(), h), list.end());
+  }
  private:
   std::vector<memtracer_t*> list;
 };
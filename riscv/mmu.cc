@@ -4,9 +4,14 @@
 #include "arith.h"
 #include "simif.h"
 #include "processor.h"
+#include "checkpoint.h"
+#include <algorithm>
+#include <cinttypes>
+#include <climits>
 
 mmu_t::mmu_t(simif_t* sim, processor_t* proc)
- : sim(sim), proc(proc),
+ : sim(sim), proc(proc), bus_hint(0), tracing(false), trace_count(0), load_reservation_paddr(0),
+   host_atomics(false), tlb_stats(),
 #ifdef RISCV_ENABLE_DUAL_ENDIAN
   target_big_endian(false),
 #endif
@@ -15,8 +20,9 @@ mmu_t::mmu_t(simif_t* sim, processor_t* proc)
   check_triggers_store(false),
   matched_trigger(NULL)
 {
-  flush_tlb();
+  set_tlb_size(TLB_SETS, TLB_WAYS);
   yield_load_reservation();
+  std::fill_n(trace_harts, TRACE_BUFFER_SIZE, proc ? proc->get_id() : 0);
 }
 
 mmu_t::~mmu_t()
@@ -25,19 +31,377 @@ mmu_t::~mmu_t()
 
 void mmu_t::flush_icache()
 {
-  for (size_t i = 0; i < ICACHE_ENTRIES; i++)
-    icache[i].tag = -1;
+  for (size_t i = 0; i < BLOCK_CACHE_ENTRIES; i++)
+    block_cache[i].tag = -1;
 }
 
 void mmu_t::flush_tlb()
 {
-  memset(tlb_insn_tag, -1, sizeof(tlb_insn_tag));
-  memset(tlb_load_tag, -1, sizeof(tlb_load_tag));
-  memset(tlb_store_tag, -1, sizeof(tlb_store_tag));
+  std::fill(tlb_insn_tag.begin(), tlb_insn_tag.end(), -1);
+  std::fill(tlb_load_tag.begin(), tlb_load_tag.end(), -1);
+  std::fill(tlb_store_tag.begin(), tlb_store_tag.end(), -1);
+  for (auto& superpage : tlb_superpages)
+    superpage.tag = -1;
+  tlb_superpage_victim = 0;
+  flush_walk_cache();
+  flush_gstage_cache(false, 0);
+  tlb_stats.flushes++;
+
+  tlb_contexts.clear();
+  tlb_context_ids.clear();
+  tlb_context_superpages.clear();
+  tlb_context = current_tlb_context();
+  tlb_contexts[tlb_context] = 0;
+  tlb_context_ids.push_back(tlb_context);
+  tlb_context_superpages.push_back(false);
+  tlb_context_tag = 0;
 
   flush_icache();
 }
 
+void mmu_t::checkpoint(checkpoint_t& c)
+{
+  // host addresses differ from run to run, so the reservation is saved by
+  // its physical address
+  bool reserved = load_reservation_address != reg_t(-1);
+  c.io(reserved);
+  c.io(load_reservation_paddr);
+  c.io(load_reservation_value);
+
+  if (c.restoring()) {
+    flush_tlb();
+    yield_load_reservation();
+    if (reserved)
+      load_reservation_address = (reg_t)sim->addr_to_mem(load_reservation_paddr, &bus_hint);
+  }
+}
+
+void mmu_t::flush_walk_cache()
+{
+  for (auto& row : walk_cache_tag)
+    std::fill(std::begin(row), std::end(row), -1);
+}
+
+void mmu_t::flush_gstage_cache(bool has_vmid, reg_t vmid)
+{
+  const reg_t vmid_mask = proc && proc->get_const_xlen() == 32 ? HGATP32_VMID : HGATP64_VMID;
+  for (auto& entry : gstage_cache) {
+    if (!has_vmid || get_field(entry.hgatp, vmid_mask) == (vmid & (vmid_mask >> ctz(vmid_mask))))
+      entry.gpn = -1;
+  }
+}
+
+void mmu_t::set_tlb_size(size_t sets, size_t ways)
+{
+  assert(sets > 0 && (sets & (sets - 1)) == 0);
+  assert(ways > 0 && (ways & (ways - 1)) == 0);
+
+  tlb_ways = ways;
+  tlb_way_shift = ctz(ways);
+  tlb_set_mask = sets - 1;
+  tlb_data.resize(sets * ways);
+  tlb_insn_tag.resize(sets * ways);
+  tlb_load_tag.resize(sets * ways);
+  tlb_store_tag.resize(sets * ways);
+
+  flush_tlb();
+}
+
+tlb_context_t mmu_t::current_tlb_context()
+{
+  // the TLB of a hart-less MMU, or one whose CSRs are still being
+  // constructed, translates nothing
+  if (!proc || !proc->state.sstatus)
+    return {PRV_M, 0, 0, 0, 0, 0};
+
+  const state_t* state = &proc->state;
+  const reg_t mstatus = state->mstatus->read();
+  tlb_context_t context = {state->prv, state->v, mstatus & MSTATUS_MPRV, 0, 0, 0};
+  if (state->prv == PRV_M && !(mstatus & MSTATUS_MPRV))
+    return context;
+
+  context.mstatus = mstatus & (MSTATUS_MPRV | MSTATUS_SUM | MSTATUS_MXR);
+  context.satp = state->satp->readvirt(state->v);
+  if (state->v) {
+    context.vsstatus = state->vsstatus->read() & (MSTATUS_SUM | MSTATUS_MXR);
+    context.hgatp = state->hgatp->read();
+  }
+  return context;
+}
+
+void mmu_t::switch_tlb_context()
+{
+  tlb_context_t context = current_tlb_context();
+  if (!(context != tlb_context))
+    return;
+
+  auto it = tlb_contexts.find(context);
+  if (it == tlb_contexts.end()) {
+    if (tlb_context_ids.size() == TLB_CONTEXTS) {
+      flush_tlb();
+      return;
+    }
+    it = tlb_contexts.emplace(context, tlb_context_ids.size()).first;
+    tlb_context_ids.push_back(context);
+    tlb_context_superpages.push_back(false);
+  }
+
+  tlb_context = context;
+  tlb_context_tag = it->second << TLB_CONTEXT_SHIFT;
+}
+
+void mmu_t::flush_tlb_vma(bool virt, bool has_addr, reg_t addr, bool has_asid, reg_t asid)
+{
+  if (!proc)
+    return flush_tlb();
+
+  const bool rv64 = proc->get_const_xlen() == 64;
+  const reg_t asid_mask = rv64 ? SATP64_ASID : SATP32_ASID;
+  const reg_t vmid_mask = rv64 ? HGATP64_VMID : HGATP32_VMID;
+  const reg_t vmid = get_field(proc->state.hgatp->read(), vmid_mask);
+  auto affected = [&](const tlb_context_t& context) {
+    if (context.prv == PRV_M && !context.mstatus)
+      return false; // bare M-mode accesses are never translated
+    if (context.virt != virt)
+      return false;
+    if (virt && get_field(context.hgatp, vmid_mask) != vmid)
+      return false;
+    return !has_asid || get_field(context.satp, asid_mask) == (asid & (asid_mask >> ctz(asid_mask)));
+  };
+
+  tlb_stats.selective_flushes++;
+
+  if (has_addr) {
+    // only the entries for this page need to go, unless it may belong to a
+    // superpage, whose other pages would be cached under other VPNs
+    reg_t vpn = addr >> PGSHIFT;
+    size_t idx = tlb_index(vpn);
+    for (size_t i = idx; i < idx + tlb_ways; i++) {
+      for (auto tags : {&tlb_insn_tag, &tlb_load_tag, &tlb_store_tag}) {
+        reg_t tag = (*tags)[i] & ~TLB_CHECK_TRIGGERS;
+        size_t id = tag >> TLB_CONTEXT_SHIFT;
+        if ((tag & ~(reg_t(-1) << TLB_CONTEXT_SHIFT)) == vpn && id < tlb_context_ids.size()
+            && affected(tlb_context_ids[id]))
+          (*tags)[i] = -1;
+      }
+    }
+
+    // the fence need not order updates of non-leaf PTEs, but drop the
+    // cached ones on the path to the page anyway, as it costs nothing
+    const int idxbits = rv64 ? 9 : 10;
+    for (size_t level = 0; level < WALK_CACHE_LEVELS; level++) {
+      reg_t prefix = addr >> (PGSHIFT + (level + 1) * idxbits);
+      reg_t& tag = walk_cache_tag[level][prefix % WALK_CACHE_ENTRIES];
+      size_t id = tag >> TLB_CONTEXT_SHIFT;
+      if ((tag & ~(reg_t(-1) << TLB_CONTEXT_SHIFT)) == prefix && id < tlb_context_ids.size()
+          && affected(tlb_context_ids[id]))
+        tag = -1;
+    }
+    flush_icache();
+  }
+
+  // retire the affected contexts; they get fresh ids when next used
+  for (auto it = tlb_contexts.begin(); it != tlb_contexts.end(); ) {
+    if (affected(it->first) && (!has_addr || tlb_context_superpages[it->second]))
+      it = tlb_contexts.erase(it);
+    else
+      ++it;
+  }
+  if (tlb_contexts.find(tlb_context) == tlb_contexts.end()) {
+    tlb_context = {reg_t(-1), 0, 0, 0, 0, 0};
+    switch_tlb_context();
+  }
+}
+
+void mmu_t::flush_tlb_gvma(bool has_vmid, reg_t vmid)
+{
+  if (!proc)
+    return flush_tlb();
+
+  const reg_t vmid_mask = proc->get_const_xlen() == 64 ? HGATP64_VMID : HGATP32_VMID;
+
+  // guest-physical addresses are not recorded in the TLB, so retire every
+  // guest address space of the VMID
+  tlb_stats.selective_flushes++;
+  flush_gstage_cache(has_vmid, vmid);
+  for (auto it = tlb_contexts.begin(); it != tlb_contexts.end(); ) {
+    if (it->first.virt && (!has_vmid || get_field(it->first.hgatp, vmid_mask) == (vmid & (vmid_mask >> ctz(vmid_mask)))))
+      it = tlb_contexts.erase(it);
+    else
+      ++it;
+  }
+  if (tlb_contexts.find(tlb_context) == tlb_contexts.end()) {
+    tlb_context = {reg_t(-1), 0, 0, 0, 0, 0};
+    switch_tlb_context();
+  }
+}
+
+void mmu_t::print_tlb_stats() const
+{
+  uint64_t accesses = tlb_stats.hits + tlb_stats.other_way_hits + tlb_stats.misses;
+  if (accesses == 0)
+    return;
+
+  unsigned id = proc ? proc->get_id() : 0;
+  printf("TLB%u Sets:                  %zu\n", id, tlb_data.size() >> tlb_way_shift);
+  printf("TLB%u Ways:                  %zu\n", id, tlb_ways);
+  printf("TLB%u Hits:                  %" PRIu64 "\n", id, tlb_stats.hits);
+  printf("TLB%u Hits in Other Ways:    %" PRIu64 "\n", id, tlb_stats.other_way_hits);
+  printf("TLB%u Misses:                %" PRIu64 "\n", id, tlb_stats.misses);
+  printf("TLB%u Misses in Superpages:  %" PRIu64 "\n", id, tlb_stats.superpage_hits);
+  printf("TLB%u Walk Cache Hits:       %" PRIu64 "\n", id, tlb_stats.walk_cache_hits);
+  printf("TLB%u G-stage Cache Hits:    %" PRIu64 "\n", id, tlb_stats.gstage_hits);
+  printf("TLB%u Flushes:               %" PRIu64 "\n", id, tlb_stats.flushes);
+  printf("TLB%u Selective Flushes:     %" PRIu64 "\n", id, tlb_stats.selective_flushes);
+  printf("TLB%u Miss Rate:             %.3f%%\n", id, 100.0 * tlb_stats.misses / accesses);
+}
+
+bool mmu_t::tlb_probe(std::vector<reg_t>& tags, size_t idx, reg_t tag)
+{
+  for (size_t way = 0; way < tlb_ways; way++) {
+    if ((tags[idx + way] & ~TLB_CHECK_TRIGGERS) == tag) {
+      if (way == 0) {
+        tlb_stats.hits++;
+      } else {
+        tlb_stats.other_way_hits++;
+        tlb_move_to_front(idx, way);
+      }
+      return true;
+    }
+  }
+  return false;
+}
+
+bool mmu_t::superpage_lookup(reg_t addr, access_type type, reg_t* paddr)
+{
+  reg_t vpn = addr >> PGSHIFT;
+  for (auto& superpage : tlb_superpages) {
+    if (superpage.tag == ((vpn >> superpage.bits << superpage.bits) | tlb_context_tag)
+        && (superpage.types & (1U << type))) {
+      reg_t offset = vpn & ((reg_t(1) << superpage.bits) - 1);
+      *paddr = ((superpage.ppn + offset) << PGSHIFT) | (addr & (PGSIZE - 1));
+      tlb_stats.superpage_hits++;
+      return true;
+    }
+  }
+  return false;
+}
+
+void mmu_t::superpage_insert(reg_t addr, reg_t paddr, access_type type, int bits)
+{
+  reg_t mask = (reg_t(1) << bits) - 1;
+  reg_t tag = ((addr >> PGSHIFT) & ~mask) | tlb_context_tag;
+  reg_t ppn = (paddr >> PGSHIFT) & ~mask;
+
+  for (auto& superpage : tlb_superpages) {
+    if (superpage.tag == tag && superpage.bits == bits && superpage.ppn == ppn) {
+      superpage.types |= 1U << type;
+      return;
+    }
+  }
+
+  tlb_superpages[tlb_superpage_victim] = {tag, bits, ppn, 1U << type};
+  tlb_superpage_victim = (tlb_superpage_victim + 1) % TLB_SUPERPAGES;
+  tlb_context_superpages[tlb_context_tag >> TLB_CONTEXT_SHIFT] = true;
+}
+
+void mmu_t::tlb_move_to_front(size_t idx, size_t way)
+{
+  std::rotate(tlb_data.begin() + idx, tlb_data.begin() + idx + way, tlb_data.begin() + idx + way + 1);
+  std::rotate(tlb_insn_tag.begin() + idx, tlb_insn_tag.begin() + idx + way, tlb_insn_tag.begin() + idx + way + 1);
+  std::rotate(tlb_load_tag.begin() + idx, tlb_load_tag.begin() + idx + way, tlb_load_tag.begin() + idx + way + 1);
+  std::rotate(tlb_store_tag.begin() + idx, tlb_store_tag.begin() + idx + way, tlb_store_tag.begin() + idx + way + 1);
+}
+
+// Returns true if the instruction may redirect control flow, serialize the
+// simulator or change how later instructions are fetched, so that it must be
+// the last instruction of a basic block.
+static bool insn_ends_block(insn_bits_t insn, unsigned xlen)
+{
+  switch (insn & 0x3) {
+    case 0x0: // compressed loads and stores
+      return false;
+    case 0x1: // c.jal, c.j, c.beqz, c.bnez
+      switch ((insn >> 13) & 0x7) {
+        case 1: return xlen == 32;
+        case 5: case 6: case 7: return true;
+        default: return false;
+      }
+    case 0x2: // c.jr, c.jalr, c.ebreak and the Zcmp/Zcmt encodings
+      switch ((insn >> 13) & 0x7) {
+        case 4: case 5: return true;
+        default: return false;
+      }
+  }
+
+  switch (insn & 0x7f) {
+    case 0x03: // LOAD
+    case 0x07: // LOAD-FP
+    case 0x13: // OP-IMM
+    case 0x17: // AUIPC
+    case 0x1b: // OP-IMM-32
+    case 0x23: // STORE
+    case 0x27: // STORE-FP
+    case 0x2f: // AMO
+    case 0x33: // OP
+    case 0x37: // LUI
+    case 0x3b: // OP-32
+    case 0x43: // MADD
+    case 0x47: // MSUB
+    case 0x4b: // NMSUB
+    case 0x4f: // NMADD
+    case 0x53: // OP-FP
+    case 0x57: // OP-V
+      return false;
+    default: // branches, jumps, SYSTEM, MISC-MEM, custom and longer encodings
+      return true;
+  }
+}
+
+insn_block_t* mmu_t::refill_block_cache(reg_t addr, insn_block_t* block)
+{
+  // the first instruction goes through the ordinary fetch path, which
+  // handles faults, triggers, tracing, MMIO and page-straddling instructions.
+  icache_entry_t entry;
+  refill_icache(addr, &entry);
+
+  block->tag = entry.tag;
+  block->context = tlb_context_tag;
+  block->len = 1;
+  block->insns[0] = entry.data;
+  block->jit_code = NULL;
+  block->jit_hits = 0;
+  block->bbv_id = 0;
+  block->mix_id = 0;
+  block->paddr = entry.paddr;
+
+  // only extend the block within a page the ITLB maps directly to host memory
+  reg_t vpn = addr >> PGSHIFT;
+  size_t idx = tlb_index(vpn);
+  if (tlb_insn_tag[idx] != (vpn | tlb_context_tag))
+    return block;
+
+  const char* host_offset = tlb_data[idx].host_offset;
+  reg_t page_end = (addr & PGMASK) + PGSIZE;
+  insn_bits_t insn = entry.data.insn.bits();
+  reg_t pc = addr + insn_length(insn);
+  while (block->len < MAX_BLOCK_INSNS && !insn_ends_block(insn, proc->get_xlen())) {
+    if (pc + 2 > page_end)
+      break;
+    insn = from_le(*(const uint16_t*)(host_offset + pc));
+    reg_t length = insn_length(insn);
+    if (length > 4 || pc + length > page_end)
+      break;
+    if (length == 4)
+      insn |= (insn_bits_t)from_le(*(const uint16_t*)(host_offset + pc + 2)) << 16;
+
+    block->insns[block->len++] = {proc->decode_insn(insn), insn};
+    pc += length;
+  }
+
+  return block;
+}
+
 static void throw_access_exception(bool virt, reg_t addr, access_type type)
 {
   switch (type) {
@@ -68,7 +432,16 @@ reg_t mmu_t::translate(reg_t addr, reg_t len, access_type type, uint32_t xlate_f
     }
   }
 
-  reg_t paddr = walk(addr, type, mode, virt, hlvx) | (addr & (PGSIZE-1));
+  // superpage entries hold translations made in the current context, so
+  // they are only good for accesses translated the way fetches are
+  reg_t paddr;
+  bool in_context = xlate_flags == 0 && mode == proc->state.prv && virt == proc->state.v && mode != PRV_M;
+  if (!in_context || !superpage_lookup(addr, type, &paddr)) {
+    int leaf_bits;
+    paddr = walk(addr, type, mode, virt, hlvx, in_context, &leaf_bits) | (addr & (PGSIZE-1));
+    if (in_context && leaf_bits > 0)
+      superpage_insert(addr, paddr, type, leaf_bits);
+  }
   if (!pmp_ok(paddr, len, type, mode))
     throw_access_exception(virt, addr, type);
   return paddr;
@@ -76,9 +449,10 @@ reg_t mmu_t::translate(reg_t addr, reg_t len, access_type type, uint32_t xlate_f
 
 tlb_entry_t mmu_t::fetch_slow_path(reg_t vaddr)
 {
+  tlb_stats.misses++;
   reg_t paddr = translate(vaddr, sizeof(fetch_temp), FETCH, 0);
 
-  if (auto host_addr = sim->addr_to_mem(paddr)) {
+  if (auto host_addr = sim->addr_to_mem(paddr, &bus_hint)) {
     return refill_tlb(vaddr, paddr, host_addr, FETCH);
   } else {
     if (!mmio_load(paddr, sizeof fetch_temp, (uint8_t*)&fetch_temp))
@@ -128,7 +502,7 @@ bool mmu_t::mmio_load(reg_t addr, size_t len, uint8_t* bytes)
   if (!mmio_ok(addr, LOAD))
     return false;
 
-  return sim->mmio_load(addr, len, bytes);
+  return sim->mmio_load(addr, len, bytes, &bus_hint);
 }
 
 bool mmu_t::mmio_store(reg_t addr, size_t len, const uint8_t* bytes)
@@ -136,18 +510,20 @@ bool mmu_t::mmio_store(reg_t addr, size_t len, const uint8_t* bytes)
   if (!mmio_ok(addr, STORE))
     return false;
 
-  return sim->mmio_store(addr, len, bytes);
+  return sim->mmio_store(addr, len, bytes, &bus_hint);
 }
 
 void mmu_t::load_slow_path(reg_t addr, reg_t len, uint8_t* bytes, uint32_t xlate_flags)
 {
+  if (xlate_flags == 0)
+    tlb_stats.misses++;
   reg_t paddr = translate(addr, len, LOAD, xlate_flags);
 
-  if (auto host_addr = sim->addr_to_mem(paddr)) {
+  if (auto host_addr = sim->addr_to_mem(paddr, &bus_hint)) {
     memcpy(bytes, host_addr, len);
-    if (tracer.interested_in_range(paddr, paddr + PGSIZE, LOAD))
-      tracer.trace(paddr, len, LOAD);
-    else if (xlate_flags == 0)
+    if (tracing)
+      trace_access(paddr, len, LOAD);
+    if (xlate_flags == 0)
       refill_tlb(addr, paddr, host_addr, LOAD);
   } else if (!mmio_load(paddr, len, bytes)) {
     throw trap_load_access_fault((proc) ? proc->state.v : false, addr, 0, 0);
@@ -163,6 +539,8 @@ void mmu_t::load_slow_path(reg_t addr, reg_t len, uint8_t* bytes, uint32_t xlate
 
 void mmu_t::store_slow_path(reg_t addr, reg_t len, const uint8_t* bytes, uint32_t xlate_flags, bool actually_store)
 {
+  if (xlate_flags == 0)
+    tlb_stats.misses++;
   reg_t paddr = translate(addr, len, STORE, xlate_flags);
 
   if (!matched_trigger) {
@@ -173,11 +551,11 @@ void mmu_t::store_slow_path(reg_t addr, reg_t len, const uint8_t* bytes, uint32_
   }
 
   if (actually_store) {
-    if (auto host_addr = sim->addr_to_mem(paddr)) {
+    if (auto host_addr = sim->addr_to_mem(paddr, &bus_hint)) {
       memcpy(host_addr, bytes, len);
-      if (tracer.interested_in_range(paddr, paddr + PGSIZE, STORE))
-        tracer.trace(paddr, len, STORE);
-      else if (xlate_flags == 0)
+      if (tracing)
+        trace_access(paddr, len, STORE);
+      if (xlate_flags == 0)
         refill_tlb(addr, paddr, host_addr, STORE);
     } else if (!mmio_store(paddr, len, bytes)) {
       throw trap_store_access_fault((proc) ? proc->state.v : false, addr, 0, 0);
@@ -187,14 +565,24 @@ void mmu_t::store_slow_path(reg_t addr, reg_t len, const uint8_t* bytes, uint32_
 
 tlb_entry_t mmu_t::refill_tlb(reg_t vaddr, reg_t paddr, char* host_addr, access_type type)
 {
-  reg_t idx = (vaddr >> PGSHIFT) % TLB_ENTRIES;
-  reg_t expected_tag = vaddr >> PGSHIFT;
+  reg_t idx = tlb_index(vaddr >> PGSHIFT);
+  reg_t expected_tag = (vaddr >> PGSHIFT) | tlb_context_tag;
 
   tlb_entry_t entry = {host_addr - vaddr, paddr - vaddr};
 
   if (proc && get_field(proc->state.mstatus->read(), MSTATUS_MPRV))
     return entry;
 
+  // reuse the way that already maps this page, else replace the least
+  // recently used one, and make it the most recently used
+  size_t way = 0;
+  while (way < tlb_ways - 1 &&
+         (tlb_insn_tag[idx + way] & ~TLB_CHECK_TRIGGERS) != expected_tag &&
+         (tlb_load_tag[idx + way] & ~TLB_CHECK_TRIGGERS) != expected_tag &&
+         (tlb_store_tag[idx + way] & ~TLB_CHECK_TRIGGERS) != expected_tag)
+    way++;
+  tlb_move_to_front(idx, way);
+
   if ((tlb_load_tag[idx] & ~TLB_CHECK_TRIGGERS) != expected_tag)
     tlb_load_tag[idx] = -1;
   if ((tlb_store_tag[idx] & ~TLB_CHECK_TRIGGERS) != expected_tag)
@@ -264,8 +652,12 @@ reg_t mmu_t::pmp_homogeneous(reg_t addr, reg_t len)
   return true;
 }
 
-reg_t mmu_t::s2xlate(reg_t gva, reg_t gpa, access_type type, access_type trap_type, bool virt, bool hlvx)
+reg_t mmu_t::s2xlate(reg_t gva, reg_t gpa, access_type type, access_type trap_type, bool virt, bool hlvx,
+                     int* leaf_bits)
 {
+  if (leaf_bits)
+    *leaf_bits = INT_MAX;
+
   if (!virt)
     return gpa;
 
@@ -278,6 +670,18 @@ reg_t mmu_t::s2xlate(reg_t gva, reg_t gpa, access_type type, access_type trap_ty
 
   bool mxr = proc->state.sstatus->readvirt(false) & MSTATUS_MXR;
 
+  // HLVX is permitted by execute permission, so it is cached as a fourth type
+  const reg_t hgatp = proc->get_state()->hgatp->read();
+  const unsigned cache_type = 1U << (hlvx ? FETCH + 1 : type);
+  reg_t gpn = gpa >> PGSHIFT;
+  gstage_cache_entry_t* entry = &gstage_cache[gpn % GSTAGE_CACHE_ENTRIES];
+  if (entry->gpn == gpn && entry->hgatp == hgatp && entry->mxr == mxr && (entry->types & cache_type)) {
+    tlb_stats.gstage_hits++;
+    if (leaf_bits)
+      *leaf_bits = entry->bits;
+    return (entry->ppn << PGSHIFT) | (gpa & (PGSIZE - 1));
+  }
+
   reg_t base = vm.ptbase;
   if ((gpa & ~maxgpa) == 0) {
     for (int i = vm.levels - 1; i >= 0; i--) {
@@ -287,7 +691,7 @@ reg_t mmu_t::s2xlate(reg_t gva, reg_t gpa, access_type type, access_type trap_ty
 
       // check that physical address of PTE is legal
       auto pte_paddr = base + idx * vm.ptesize;
-      auto ppte = sim->addr_to_mem(pte_paddr);
+      auto ppte = sim->addr_to_mem(pte_paddr, &bus_hint);
       if (!ppte || !pmp_ok(pte_paddr, vm.ptesize, LOAD, PRV_S)) {
         throw_access_exception(virt, gva, trap_type);
       }
@@ -342,6 +746,14 @@ reg_t mmu_t::s2xlate(reg_t gva, reg_t gpa, access_type type, access_type trap_ty
         reg_t page_base = ((ppn & ~((reg_t(1) << napot_bits) - 1))
                           | (vpn & ((reg_t(1) << napot_bits) - 1))
                           | (vpn & ((reg_t(1) << ptshift) - 1))) << PGSHIFT;
+        int bits = std::max(napot_bits, ptshift);
+        if (entry->gpn == gpn && entry->hgatp == hgatp && entry->mxr == mxr
+            && entry->ppn == page_base >> PGSHIFT)
+          entry->types |= cache_type;
+        else
+          *entry = {gpn, hgatp, mxr, page_base >> PGSHIFT, bits, cache_type};
+        if (leaf_bits)
+          *leaf_bits = bits;
         return page_base | (gpa & page_mask);
       }
     }
@@ -355,13 +767,20 @@ reg_t mmu_t::s2xlate(reg_t gva, reg_t gpa, access_type type, access_type trap_ty
   }
 }
 
-reg_t mmu_t::walk(reg_t addr, access_type type, reg_t mode, bool virt, bool hlvx)
+reg_t mmu_t::walk(reg_t addr, access_type type, reg_t mode, bool virt, bool hlvx, bool in_context,
+                  int* leaf_bits)
 {
   reg_t page_mask = (reg_t(1) << PGSHIFT) - 1;
   reg_t satp = proc->get_state()->satp->readvirt(virt);
   vm_info vm = decode_vm_info(proc->get_const_xlen(), false, mode, satp);
-  if (vm.levels == 0)
-    return s2xlate(addr, addr & ((reg_t(2) << (proc->xlen-1))-1), type, type, virt, hlvx) & ~page_mask; // zero-extend from xlen
+  if (vm.levels == 0) {
+    int g_bits;
+    reg_t paddr = s2xlate(addr, addr & ((reg_t(2) << (proc->xlen-1))-1), type, type, virt, hlvx, &g_bits) & ~page_mask; // zero-extend from xlen
+    // an untranslated address is as cheap to translate again as to look up
+    if (leaf_bits)
+      *leaf_bits = g_bits == INT_MAX ? 0 : g_bits;
+    return paddr;
+  }
 
   bool s_mode = mode == PRV_S;
   bool sum = proc->state.sstatus->readvirt(virt) & MSTATUS_SUM;
@@ -374,14 +793,26 @@ reg_t mmu_t::walk(reg_t addr, access_type type, reg_t mode, bool virt, bool hlvx
   if (masked_msbs != 0 && masked_msbs != mask)
     vm.levels = 0;
 
+  // resume the walk from the deepest page table the walk cache knows
   reg_t base = vm.ptbase;
-  for (int i = vm.levels - 1; i >= 0; i--) {
+  int start = vm.levels - 1;
+  for (int i = 0; in_context && i < std::min(start, int(WALK_CACHE_LEVELS)); i++) {
+    reg_t tag = (addr >> (PGSHIFT + (i + 1) * vm.idxbits)) | tlb_context_tag;
+    if (walk_cache_tag[i][tag % WALK_CACHE_ENTRIES] == tag) {
+      base = walk_cache_base[i][tag % WALK_CACHE_ENTRIES];
+      tlb_stats.walk_cache_hits += start - i;
+      start = i;
+      break;
+    }
+  }
+
+  for (int i = start; i >= 0; i--) {
     int ptshift = i * vm.idxbits;
     reg_t idx = (addr >> (PGSHIFT + ptshift)) & ((1 << vm.idxbits) - 1);
 
     // check that physical address of PTE is legal
     auto pte_paddr = s2xlate(addr, base + idx * vm.ptesize, LOAD, type, virt, false);
-    auto ppte = sim->addr_to_mem(pte_paddr);
+    auto ppte = sim->addr_to_mem(pte_paddr, &bus_hint);
     if (!ppte || !pmp_ok(pte_paddr, vm.ptesize, LOAD, PRV_S))
       throw_access_exception(virt, addr, type);
 
@@ -401,6 +832,11 @@ reg_t mmu_t::walk(reg_t addr, access_type type, reg_t mode, bool virt, bool hlvx
       if (pte & (PTE_D | PTE_A | PTE_U | PTE_N | PTE_PBMT))
         break;
       base = ppn << PGSHIFT;
+      if (in_context && i > 0 && i <= int(WALK_CACHE_LEVELS)) {
+        reg_t tag = (addr >> (PGSHIFT + ptshift)) | tlb_context_tag;
+        walk_cache_tag[i - 1][tag % WALK_CACHE_ENTRIES] = tag;
+        walk_cache_base[i - 1][tag % WALK_CACHE_ENTRIES] = base;
+      }
     } else if ((pte & PTE_U) ? s_mode && (type == FETCH || !sum) : !s_mode) {
       break;
     } else if (!(pte & PTE_V) || (!(pte & PTE_R) && (pte & PTE_W))) {
@@ -436,7 +872,11 @@ reg_t mmu_t::walk(reg_t addr, access_type type, reg_t mode, bool virt, bool hlvx
                         | (vpn & ((reg_t(1) << napot_bits) - 1))
                         | (vpn & ((reg_t(1) << ptshift) - 1))) << PGSHIFT;
       reg_t phys = page_base | (addr & page_mask);
-      return s2xlate(addr, phys, type, type, virt, hlvx) & ~page_mask;
+      int g_bits;
+      reg_t paddr = s2xlate(addr, phys, type, type, virt, hlvx, &g_bits) & ~page_mask;
+      if (leaf_bits)
+        *leaf_bits = std::min(std::max(napot_bits, ptshift), g_bits);
+      return paddr;
     }
   }
 
@@ -450,6 +890,25 @@ reg_t mmu_t::walk(reg_t addr, access_type type, reg_t mode, bool virt, bool hlvx
 
 void mmu_t::register_memtracer(memtracer_t* t)
 {
-  flush_tlb();
+  flush_trace();
   tracer.hook(t);
+  tracing = true;
+}
+
+void mmu_t::unregister_memtracer(memtracer_t* t)
+{
+  flush_trace();
+  tracer.unhook(t);
+  tracing = !tracer.empty();
+}
+
+void mmu_t::flush_trace()
+{
+  if (trace_count == 0)
+    return;
+
+  memtrace_batch_t batch = {trace_count, trace_addrs, trace_bytes, trace_types,
+                            trace_harts, trace_pcs};
+  trace_count = 0;
+  tracer.trace_batch(batch);
 }
@@ -13,13 +13,17 @@
 #include "byteorder.h"
 #include "triggers.h"
 #include <stdlib.h>
+#include <stdio.h>
 #include <vector>
+#include <map>
+#include <tuple>
 
 // virtual memory configuration
 #define PGSHIFT 12
 const reg_t PGSIZE = 1 << PGSHIFT;
 const reg_t PGMASK = ~(PGSIZE-1);
 #define MAX_PADDR_BITS 56 // imposed by Sv39 / Sv48
+const size_t MAX_BLOCK_INSNS = 16;
 
 struct insn_fetch_t
 {
@@ -29,15 +33,86 @@ struct insn_fetch_t
 
 struct icache_entry_t {
   reg_t tag;
-  struct icache_entry_t* next;
+  reg_t paddr;
   insn_fetch_t data;
 };
 
+// native translation of a block; returns the number of instructions retired
+typedef size_t (*jit_code_t)(reg_t* xpr, mmu_t* mmu);
+
+// a straight-line run of pre-decoded instructions starting at pc == tag.
+// only the last instruction of a block may redirect control flow.
+struct insn_block_t {
+  reg_t tag;
+  reg_t context; // TLB context the block was fetched in
+  size_t len;
+  insn_fetch_t insns[MAX_BLOCK_INSNS];
+  jit_code_t jit_code;
+  unsigned jit_hits;
+  uint32_t bbv_id; // the block's number for the BBV profiler, 0 if unknown
+  uint32_t mix_id; // the block's number for insn_mix_t, 0 if unknown
+  reg_t paddr; // of the first instruction, for the memtracers
+};
+
 struct tlb_entry_t {
   char* host_offset;
   reg_t target_offset;
 };
 
+// the state that determines how an address translates and which accesses
+// to it are permitted.  each distinct context has its own TLB tags, so
+// switching privilege or address space does not flush the TLB.
+struct tlb_context_t {
+  reg_t prv;
+  reg_t virt;
+  reg_t mstatus; // MPRV, SUM and MXR
+  reg_t vsstatus; // SUM and MXR, if virt
+  reg_t satp; // satp or vsatp, unless in M-mode
+  reg_t hgatp; // if virt
+
+  bool operator<(const tlb_context_t& other) const
+  {
+    return std::tie(prv, virt, mstatus, vsstatus, satp, hgatp) <
+      std::tie(other.prv, other.virt, other.mstatus, other.vsstatus, other.satp, other.hgatp);
+  }
+  bool operator!=(const tlb_context_t& other) const
+  {
+    return (*this < other) || (other < *this);
+  }
+};
+
+// a leaf mapping larger than a page (a megapage, gigapage, ... or Svnapot
+// 64 KiB page) that has been walked.  TLB misses anywhere inside it are
+// refilled from it instead of walking the page tables again.
+struct tlb_superpage_t {
+  reg_t tag; // VPN of the first page, combined with the context tag
+  int bits; // log2 of the number of pages mapped
+  reg_t ppn; // of the first page
+  unsigned types; // bit 1 << type is set for each access type permitted
+};
+
+// the guest-physical page a G-stage walk translated, with the result.  the
+// hgatp and MXR it was walked with are part of the key.
+struct gstage_cache_entry_t {
+  reg_t gpn;
+  reg_t hgatp;
+  bool mxr;
+  reg_t ppn;
+  int bits; // log2 of the number of pages the leaf maps
+  unsigned types; // bit 1 << type is set for each access type permitted
+};
+
+struct tlb_stats_t {
+  uint64_t hits; // in the most recently used way of a set
+  uint64_t other_way_hits;
+  uint64_t misses;
+  uint64_t superpage_hits; // misses that did not need a page walk
+  uint64_t walk_cache_hits; // page table levels skipped by walks
+  uint64_t gstage_hits; // G-stage translations that did not need a walk
+  uint64_t flushes; // of the whole TLB
+  uint64_t selective_flushes;
+};
+
 // this class implements a processor's port into the virtual memory system.
 // an MMU and instruction cache are maintained for simulator performance.
 class mmu_t
@@ -105,18 +180,23 @@ public:
         else return misaligned_load(addr, sizeof(type##_t), xlate_flags); \
       } \
       reg_t vpn = addr >> PGSHIFT; \
+      size_t idx = tlb_index(vpn); \
+      reg_t tag = vpn | tlb_context_tag; \
       size_t size = sizeof(type##_t); \
-      if ((xlate_flags) == 0 && likely(tlb_load_tag[vpn % TLB_ENTRIES] == vpn)) { \
+      if ((xlate_flags) == 0 && likely(tlb_load_tag[idx] == tag)) { \
+        tlb_stats.hits++; \
+        if (unlikely(tracing)) trace_access(tlb_data[idx].target_offset + addr, size, LOAD); \
         if (proc) READ_MEM(addr, size); \
-        return from_target(*(target_endian<type##_t>*)(tlb_data[vpn % TLB_ENTRIES].host_offset + addr)); \
+        return from_target(*(target_endian<type##_t>*)(tlb_data[idx].host_offset + addr)); \
       } \
-      if ((xlate_flags) == 0 && unlikely(tlb_load_tag[vpn % TLB_ENTRIES] == (vpn | TLB_CHECK_TRIGGERS))) { \
-        type##_t data = from_target(*(target_endian<type##_t>*)(tlb_data[vpn % TLB_ENTRIES].host_offset + addr)); \
-        if (!matched_trigger) { \
+      if ((xlate_flags) == 0 && tlb_probe(tlb_load_tag, idx, tag)) { \
+        type##_t data = from_target(*(target_endian<type##_t>*)(tlb_data[idx].host_offset + addr)); \
+        if ((tlb_load_tag[idx] & TLB_CHECK_TRIGGERS) && !matched_trigger) { \
           matched_trigger = trigger_exception(triggers::OPERATION_LOAD, addr, data); \
           if (matched_trigger) \
             throw *matched_trigger; \
         } \
+        if (unlikely(tracing)) trace_access(tlb_data[idx].target_offset + addr, size, LOAD); \
         if (proc) READ_MEM(addr, size); \
         return data; \
       } \
@@ -126,6 +206,26 @@ public:
       return from_target(res); \
     }
 
+  // host address of an aligned access that hits in the TLB fast path, or
+  // NULL if the access must take the slow path.  used by translated code.
+  char* fast_load_host_addr(reg_t addr)
+  {
+    reg_t vpn = addr >> PGSHIFT;
+    size_t idx = tlb_index(vpn);
+    if (likely(tlb_load_tag[idx] == (vpn | tlb_context_tag)))
+      return tlb_data[idx].host_offset + addr;
+    return NULL;
+  }
+
+  char* fast_store_host_addr(reg_t addr)
+  {
+    reg_t vpn = addr >> PGSHIFT;
+    size_t idx = tlb_index(vpn);
+    if (likely(tlb_store_tag[idx] == (vpn | tlb_context_tag)))
+      return tlb_data[idx].host_offset + addr;
+    return NULL;
+  }
+
   // load value from memory at aligned address; zero extend to register width
   load_func(uint8, load, 0)
   load_func(uint16, load, 0)
@@ -168,22 +268,27 @@ public:
         else return misaligned_store(addr, val, sizeof(type##_t), xlate_flags, actually_store); \
       } \
       reg_t vpn = addr >> PGSHIFT; \
+      size_t idx = tlb_index(vpn); \
+      reg_t tag = vpn | tlb_context_tag; \
       size_t size = sizeof(type##_t); \
-      if ((xlate_flags) == 0 && likely(tlb_store_tag[vpn % TLB_ENTRIES] == vpn)) { \
+      if ((xlate_flags) == 0 && likely(tlb_store_tag[idx] == tag)) { \
+        tlb_stats.hits++; \
         if (actually_store) { \
+          if (unlikely(tracing)) trace_access(tlb_data[idx].target_offset + addr, size, STORE); \
           if (proc) WRITE_MEM(addr, val, size); \
-          *(target_endian<type##_t>*)(tlb_data[vpn % TLB_ENTRIES].host_offset + addr) = to_target(val); \
+          *(target_endian<type##_t>*)(tlb_data[idx].host_offset + addr) = to_target(val); \
         } \
       } \
-      else if ((xlate_flags) == 0 && unlikely(tlb_store_tag[vpn % TLB_ENTRIES] == (vpn | TLB_CHECK_TRIGGERS))) { \
+      else if ((xlate_flags) == 0 && tlb_probe(tlb_store_tag, idx, tag)) { \
         if (actually_store) { \
-          if (!matched_trigger) { \
+          if ((tlb_store_tag[idx] & TLB_CHECK_TRIGGERS) && !matched_trigger) { \
             matched_trigger = trigger_exception(triggers::OPERATION_STORE, addr, val); \
             if (matched_trigger) \
               throw *matched_trigger; \
           } \
+          if (unlikely(tracing)) trace_access(tlb_data[idx].target_offset + addr, size, STORE); \
           if (proc) WRITE_MEM(addr, val, size); \
-          *(target_endian<type##_t>*)(tlb_data[vpn % TLB_ENTRIES].host_offset + addr) = to_target(val); \
+          *(target_endian<type##_t>*)(tlb_data[idx].host_offset + addr) = to_target(val); \
         } \
       } \
       else { \
@@ -209,11 +314,31 @@ public:
     }
 
   // template for functions that perform an atomic memory operation
+  // with host_atomics, an AMO to a directly-mapped page is a host
+  // compare-and-swap loop, so it is atomic with respect to harts running on
+  // other host threads.
   #define amo_func(type) \
     template<typename op> \
     type##_t amo_##type(reg_t addr, op f) { \
       convert_load_traps_to_store_traps({ \
         store_##type(addr, 0, false, true); \
+        if (host_atomics && !target_big_endian && fast_load_host_addr(addr)) { \
+          if (auto host_addr = (type##_t*)fast_store_host_addr(addr)) { \
+            type##_t lhs = __atomic_load_n(host_addr, __ATOMIC_RELAXED); \
+            type##_t val; \
+            do { \
+              val = f(lhs); \
+            } while (!__atomic_compare_exchange_n(host_addr, &lhs, val, true, \
+                                                  __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)); \
+            if (unlikely(tracing)) { \
+              trace_fast_access(addr, sizeof(type##_t), LOAD); \
+              trace_fast_access(addr, sizeof(type##_t), STORE); \
+            } \
+            if (proc) READ_MEM(addr, sizeof(type##_t)); \
+            if (proc) WRITE_MEM(addr, val, sizeof(type##_t)); \
+            return lhs; \
+          } \
+        } \
         auto lhs = load_##type(addr, true); \
         store_##type(addr, f(lhs)); \
         return lhs; \
@@ -255,6 +380,30 @@ public:
   amo_func(uint32)
   amo_func(uint64)
 
+  // template for functions that perform the store of an SC whose
+  // reservation is held.  with host_atomics the store is a compare-and-swap
+  // against the value the LR read, so an intervening store by a hart on
+  // another host thread makes the SC fail.
+  #define sc_func(type) \
+    bool store_conditional_##type(reg_t addr, type##_t val) { \
+      if (host_atomics && !target_big_endian) { \
+        if (auto host_addr = (type##_t*)fast_store_host_addr(addr)) { \
+          type##_t expected = load_reservation_value; \
+          if (!__atomic_compare_exchange_n(host_addr, &expected, val, false, \
+                                           __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) \
+            return false; \
+          if (unlikely(tracing)) trace_fast_access(addr, sizeof(type##_t), STORE); \
+          if (proc) WRITE_MEM(addr, val, sizeof(type##_t)); \
+          return true; \
+        } \
+      } \
+      store_##type(addr, val); \
+      return true; \
+    }
+
+  sc_func(uint32)
+  sc_func(uint64)
+
   void cbo_zero(reg_t addr) {
     auto base = addr & ~(blocksz - 1);
     for (size_t offset = 0; offset < blocksz; offset += 1)
@@ -265,9 +414,11 @@ public:
     convert_load_traps_to_store_traps({
       reg_t paddr = addr & ~(blocksz - 1);
       paddr = translate(paddr, blocksz, LOAD, 0);
-      if (auto host_addr = sim->addr_to_mem(paddr)) {
-        if (tracer.interested_in_range(paddr, paddr + PGSIZE, LOAD))
+      if (auto host_addr = sim->addr_to_mem(paddr, &bus_hint)) {
+        if (tracer.interested_in_range(paddr, paddr + PGSIZE, LOAD)) {
+          flush_trace();
           tracer.clean_invalidate(paddr, blocksz, clean, inval);
+        }
       } else {
         throw trap_store_access_fault((proc) ? proc->state.v : false, addr, 0, 0);
       }
@@ -279,11 +430,14 @@ public:
     load_reservation_address = (reg_t)-1;
   }
 
-  inline void acquire_load_reservation(reg_t vaddr)
+  inline void acquire_load_reservation(reg_t vaddr, reg_t value)
   {
+    load_reservation_value = value;
     reg_t paddr = translate(vaddr, 1, LOAD, 0);
-    if (auto host_addr = sim->addr_to_mem(paddr))
+    if (auto host_addr = sim->addr_to_mem(paddr, &bus_hint)) {
       load_reservation_address = refill_tlb(vaddr, paddr, host_addr, LOAD).target_offset + vaddr;
+      load_reservation_paddr = paddr;
+    }
     else
       throw trap_load_access_fault((proc) ? proc->state.v : false, vaddr, 0, 0); // disallow LR to I/O space
   }
@@ -314,17 +468,17 @@ public:
       store_conditional_address_misaligned(vaddr);
 
     reg_t paddr = translate(vaddr, 1, STORE, 0);
-    if (auto host_addr = sim->addr_to_mem(paddr))
+    if (auto host_addr = sim->addr_to_mem(paddr, &bus_hint))
       return load_reservation_address == refill_tlb(vaddr, paddr, host_addr, STORE).target_offset + vaddr;
     else
       throw trap_store_access_fault((proc) ? proc->state.v : false, vaddr, 0, 0); // disallow SC to I/O space
   }
 
-  static const reg_t ICACHE_ENTRIES = 1024;
+  static const reg_t BLOCK_CACHE_ENTRIES = 1024;
 
-  inline size_t icache_index(reg_t addr)
+  inline size_t block_cache_index(reg_t addr)
   {
-    return (addr / PC_ALIGN) % ICACHE_ENTRIES;
+    return (addr / PC_ALIGN) % BLOCK_CACHE_ENTRIES;
   }
 
   inline icache_entry_t* refill_icache(reg_t addr, icache_entry_t* entry)
@@ -349,35 +503,70 @@ public:
 
     insn_fetch_t fetch = {proc->decode_insn(insn), insn};
     entry->tag = addr;
-    entry->next = &icache[icache_index(addr + length)];
+    entry->paddr = tlb_entry.target_offset + addr;
     entry->data = fetch;
-
-    reg_t paddr = tlb_entry.target_offset + addr;;
-    if (tracer.interested_in_range(paddr, paddr + 1, FETCH)) {
-      entry->tag = -1;
-      tracer.trace(paddr, length, FETCH);
-    }
     return entry;
   }
 
-  inline icache_entry_t* access_icache(reg_t addr)
+  insn_block_t* refill_block_cache(reg_t addr, insn_block_t* block);
+
+  inline insn_block_t* access_block_cache(reg_t addr)
   {
-    icache_entry_t* entry = &icache[icache_index(addr)];
-    if (likely(entry->tag == addr))
-      return entry;
-    return refill_icache(addr, entry);
+    insn_block_t* block = &block_cache[block_cache_index(addr)];
+    if (likely(block->tag == addr && block->context == tlb_context_tag))
+      return block;
+    return refill_block_cache(addr, block);
   }
 
   inline insn_fetch_t load_insn(reg_t addr)
   {
     icache_entry_t entry;
-    return refill_icache(addr, &entry)->data;
+    refill_icache(addr, &entry);
+    if (unlikely(tracing))
+      trace_access(entry.paddr, insn_length(entry.data.insn.bits()), FETCH);
+    return entry.data;
   }
 
   void flush_tlb();
   void flush_icache();
 
+  // start using the TLB tags of the current translation context; called
+  // whenever privilege, satp, vsatp, hgatp or the status bits change.
+  void switch_tlb_context();
+
+  // invalidate cached translations as sfence.vma does, or as hfence.vvma
+  // does if virt.  has_addr and has_asid say whether rs1 and rs2 are not x0.
+  void flush_tlb_vma(bool virt, bool has_addr, reg_t addr, bool has_asid, reg_t asid);
+
+  // invalidate cached guest translations as hfence.gvma does
+  void flush_tlb_gvma(bool has_vmid, reg_t vmid);
+
+  // sets and ways must be powers of 2
+  void set_tlb_size(size_t sets, size_t ways);
+  void print_tlb_stats() const;
+
+  // save or restore the load reservation, and drop all cached translations
+  // when restoring
+  void checkpoint(checkpoint_t& c);
+
+  // while memtracers are attached, the TLB and block cache work as usual
+  // and the accesses are buffered, in order, to be handed to the tracers
+  // in a batch when the buffer fills up or flush_trace() is called.  the
+  // caller of access_block_cache() traces the fetches of the instructions
+  // it runs.
   void register_memtracer(memtracer_t*);
+  void unregister_memtracer(memtracer_t*);
+  bool is_tracing() const { return tracing; }
+  void trace_access(reg_t paddr, size_t bytes, access_type type)
+  {
+    trace_addrs[trace_count] = paddr;
+    trace_bytes[trace_count] = bytes;
+    trace_types[trace_count] = type;
+    trace_pcs[trace_count] = proc ? proc->state.pc : 0;
+    if (unlikely(++trace_count == TRACE_BUFFER_SIZE))
+      flush_trace();
+  }
+  void flush_trace();
 
   int is_dirty_enabled()
   {
@@ -406,6 +595,12 @@ public:
 #endif
   }
 
+  // make AMOs and SCs atomic with respect to other host threads
+  void set_host_atomics(bool enable)
+  {
+    host_atomics = enable;
+  }
+
   bool is_target_big_endian()
   {
     return target_big_endian;
@@ -429,33 +624,111 @@ public:
 private:
   simif_t* sim;
   processor_t* proc;
+  size_t bus_hint; // where the last physical address was found on the bus
   memtracer_list_t tracer;
-  reg_t load_reservation_address;
+  bool tracing; // memtracers are attached
+  static const size_t TRACE_BUFFER_SIZE = 4096;
+  size_t trace_count;
+  uint64_t trace_addrs[TRACE_BUFFER_SIZE];
+  uint32_t trace_bytes[TRACE_BUFFER_SIZE];
+  uint8_t trace_types[TRACE_BUFFER_SIZE];
+  uint32_t trace_harts[TRACE_BUFFER_SIZE]; // all this hart's id
+  uint64_t trace_pcs[TRACE_BUFFER_SIZE];
+  reg_t load_reservation_address; // host address of the reserved word
+  reg_t load_reservation_paddr; // its physical address, for checkpoints
+  reg_t load_reservation_value;
+  bool host_atomics;
   uint16_t fetch_temp;
   uint64_t blocksz;
 
-  // implement an instruction cache for simulator performance
-  icache_entry_t icache[ICACHE_ENTRIES];
-
-  // implement a TLB for simulator performance
-  static const reg_t TLB_ENTRIES = 256;
+  // implement a basic-block cache for simulator performance
+  insn_block_t block_cache[BLOCK_CACHE_ENTRIES];
+
+  // implement a set-associative TLB for simulator performance.  a tag is
+  // the VPN combined with the id of the context it was translated in.  the
+  // ways of a set are kept in most-recently-used order, so the fast paths
+  // only check way 0 and tlb_probe() searches the others.
+  static const size_t TLB_SETS = 256;
+  static const size_t TLB_WAYS = 4;
+  static const int TLB_CONTEXT_SHIFT = 64 - PGSHIFT;
+  // context ids use the bits between the VPN and TLB_CHECK_TRIGGERS.  the
+  // last id is never handed out, so an invalid tag (-1) matches nothing.
+  static const size_t TLB_CONTEXTS = (size_t(1) << (63 - TLB_CONTEXT_SHIFT)) - 1;
   // If a TLB tag has TLB_CHECK_TRIGGERS set, then the MMU must check for a
   // trigger match before completing an access.
   static const reg_t TLB_CHECK_TRIGGERS = reg_t(1) << 63;
-  tlb_entry_t tlb_data[TLB_ENTRIES];
-  reg_t tlb_insn_tag[TLB_ENTRIES];
-  reg_t tlb_load_tag[TLB_ENTRIES];
-  reg_t tlb_store_tag[TLB_ENTRIES];
+  size_t tlb_ways;
+  unsigned tlb_way_shift;
+  reg_t tlb_set_mask;
+  std::vector<tlb_entry_t> tlb_data;
+  std::vector<reg_t> tlb_insn_tag;
+  std::vector<reg_t> tlb_load_tag;
+  std::vector<reg_t> tlb_store_tag;
+  tlb_stats_t tlb_stats;
+
+  static const size_t TLB_SUPERPAGES = 16;
+  tlb_superpage_t tlb_superpages[TLB_SUPERPAGES];
+  size_t tlb_superpage_victim;
+
+  // a page-walk cache of non-leaf PTEs: an entry of row i maps the VA bits
+  // that index the levels above level i, combined with the context tag, to
+  // the (guest-)physical base of the level i page table they select.  only walks in the
+  // current context use it, so retiring a context invalidates its entries.
+  static const size_t WALK_CACHE_LEVELS = 4;
+  static const size_t WALK_CACHE_ENTRIES = 64;
+  reg_t walk_cache_tag[WALK_CACHE_LEVELS][WALK_CACHE_ENTRIES];
+  reg_t walk_cache_base[WALK_CACHE_LEVELS][WALK_CACHE_ENTRIES];
+
+  // a direct-mapped cache of G-stage translations, shared by the walks of
+  // guest page tables and of guest-physical leaf addresses
+  static const size_t GSTAGE_CACHE_ENTRIES = 256;
+  gstage_cache_entry_t gstage_cache[GSTAGE_CACHE_ENTRIES];
+
+  // context ids are only reused after a full flush; sfence.vma retires an
+  // address space by forgetting its id, which orphans its entries.
+  std::map<tlb_context_t, reg_t> tlb_contexts;
+  std::vector<tlb_context_t> tlb_context_ids;
+  std::vector<bool> tlb_context_superpages; // whether superpages were used
+  tlb_context_t tlb_context;
+  reg_t tlb_context_tag;
+
+  inline size_t tlb_index(reg_t vpn)
+  {
+    return (vpn & tlb_set_mask) << tlb_way_shift;
+  }
+
+  // trace an access that fast_load_host_addr() or fast_store_host_addr()
+  // found in the TLB
+  void trace_fast_access(reg_t addr, size_t bytes, access_type type)
+  {
+    trace_access(tlb_data[tlb_index(addr >> PGSHIFT)].target_offset + addr, bytes, type);
+  }
+
+  // look for tag in the set starting at idx, moving it to way 0 if found
+  bool tlb_probe(std::vector<reg_t>& tags, size_t idx, reg_t tag);
+  void tlb_move_to_front(size_t idx, size_t way);
+  bool superpage_lookup(reg_t addr, access_type type, reg_t* paddr);
+  void superpage_insert(reg_t addr, reg_t paddr, access_type type, int bits);
+  void flush_walk_cache();
+  void flush_gstage_cache(bool has_vmid, reg_t vmid);
+  tlb_context_t current_tlb_context();
 
   // finish translation on a TLB miss and update the TLB
   tlb_entry_t refill_tlb(reg_t vaddr, reg_t paddr, char* host_addr, access_type type);
   const char* fill_from_mmio(reg_t vaddr, reg_t paddr);
 
-  // perform a stage2 translation for a given guest address
-  reg_t s2xlate(reg_t gva, reg_t gpa, access_type type, access_type trap_type, bool virt, bool hlvx);
+  // perform a stage2 translation for a given guest address.  if leaf_bits
+  // is given, it receives log2 of the number of pages the leaf maps.
+  reg_t s2xlate(reg_t gva, reg_t gpa, access_type type, access_type trap_type, bool virt, bool hlvx,
+                int* leaf_bits = NULL);
 
-  // perform a page table walk for a given VA; set referenced/dirty bits
-  reg_t walk(reg_t addr, access_type type, reg_t prv, bool virt, bool hlvx);
+  // perform a page table walk for a given VA; set referenced/dirty bits.
+  // in_context says the walk translates the way the current TLB context
+  // does, so it may use the page-walk cache.  if leaf_bits is given, it
+  // receives log2 of the number of pages that translate contiguously around
+  // the VA, or 0 if that is not worth caching.
+  reg_t walk(reg_t addr, access_type type, reg_t prv, bool virt, bool hlvx, bool in_context,
+             int* leaf_bits = NULL);
 
   // handle uncommon cases: TLB misses, page faults, MMIO
   tlb_entry_t fetch_slow_path(reg_t addr);
@@ -469,16 +742,20 @@ private:
   // ITLB lookup
   inline tlb_entry_t translate_insn_addr(reg_t addr) {
     reg_t vpn = addr >> PGSHIFT;
-    if (likely(tlb_insn_tag[vpn % TLB_ENTRIES] == vpn))
-      return tlb_data[vpn % TLB_ENTRIES];
+    size_t idx = tlb_index(vpn);
+    reg_t tag = vpn | tlb_context_tag;
+    if (likely(tlb_insn_tag[idx] == tag)) {
+      tlb_stats.hits++;
+      return tlb_data[idx];
+    }
     tlb_entry_t result;
-    if (unlikely(tlb_insn_tag[vpn % TLB_ENTRIES] != (vpn | TLB_CHECK_TRIGGERS))) {
+    if (unlikely(!tlb_probe(tlb_insn_tag, idx, tag))) {
       result = fetch_slow_path(addr);
     } else {
-      result = tlb_data[vpn % TLB_ENTRIES];
+      result = tlb_data[idx];
     }
-    if (unlikely(tlb_insn_tag[vpn % TLB_ENTRIES] == (vpn | TLB_CHECK_TRIGGERS))) {
-      target_endian<uint16_t>* ptr = (target_endian<uint16_t>*)(tlb_data[vpn % TLB_ENTRIES].host_offset + addr);
+    if (unlikely(tlb_insn_tag[idx] == (tag | TLB_CHECK_TRIGGERS))) {
+      target_endian<uint16_t>* ptr = (target_endian<uint16_t>*)(tlb_data[idx].host_offset + addr);
       triggers::action_t action;
       auto match = proc->TM.memory_access_match(&action, triggers::OPERATION_EXECUTE, addr, from_target(*ptr));
       if (match != triggers::MATCH_NONE) {
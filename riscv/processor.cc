@@ -7,6 +7,10 @@
 #include "config.h"
 #include "simif.h"
 #include "mmu.h"
+#include "jit.h"
+#include "bbv.h"
+#include "insn_mix.h"
+#include "checkpoint.h"
 #include "disasm.h"
 #include "platform.h"
 #include <cinttypes>
@@ -26,10 +30,11 @@
 processor_t::processor_t(const isa_parser_t *isa, const char* varch,
                          simif_t* sim, uint32_t id, bool halt_on_reset,
                          FILE* log_file, std::ostream& sout_)
-  : debug(false), halt_request(HR_NONE), isa(isa), sim(sim), id(id), xlen(0),
+  : debug(false), halt_request(HR_NONE), isa(isa), sim(sim), jit(NULL), bbv(NULL), insn_mix(NULL), sampler(NULL), id(id), xlen(0),
   histogram_enabled(false), log_commits_enabled(false),
-  log_file(log_file), sout_(sout_.rdbuf()), halt_on_reset(halt_on_reset),
-  impl_table(256, false), last_pc(1), executions(1), TM(4)
+  log_file(log_file), commit_log_ring(NULL), sout_(sout_.rdbuf()), halt_on_reset(halt_on_reset),
+  impl_table(256, false), opcode_cache_hits(0), opcode_cache_misses(0), decode_comparisons(0),
+  last_pc(1), executions(1), TM(4)
 {
   VU.p = this;
   TM.proc = this;
@@ -66,15 +71,12 @@ processor_t::processor_t(const isa_parser_t *isa, const char* varch,
 
 processor_t::~processor_t()
 {
-#ifdef RISCV_ENABLE_HISTOGRAM
   if (histogram_enabled)
-  {
-    fprintf(stderr, "PC Histogram size:%zu\n", pc_histogram.size());
-    for (auto it : pc_histogram)
-      fprintf(stderr, "%0" PRIx64 " %" PRIu64 "\n", it.first, it.second);
-  }
-#endif
+    insn_mix->print_pc_histogram(stderr);
 
+  delete jit;
+  delete bbv;
+  delete insn_mix;
   delete mmu;
   delete disassembler;
 }
@@ -540,13 +542,46 @@ void processor_t::set_debug(bool value)
 void processor_t::set_histogram(bool value)
 {
   histogram_enabled = value;
-#ifndef RISCV_ENABLE_HISTOGRAM
-  if (value) {
-    fprintf(stderr, "PC Histogram support has not been properly enabled;");
-    fprintf(stderr, " please re-build the riscv-isa-sim project using \"configure --enable-histogram\".\n");
+  if (value && !insn_mix)
+    insn_mix = new insn_mix_t(this, false);
+}
+
+void processor_t::set_insn_mix(bool by_mode)
+{
+  // the PC histogram shares the counts, which must be split from the start
+  if (!insn_mix || by_mode) {
+    delete insn_mix;
+    insn_mix = new insn_mix_t(this, by_mode);
+  }
+}
+
+void processor_t::set_jit(bool value)
+{
+  delete jit;
+  jit = NULL;
+  if (!value)
+    return;
+
+  if (!jit_t::supported()) {
+    fprintf(stderr, "JIT support is not available on this host.\n");
     abort();
   }
-#endif
+
+  // translated code only implements RV64I/M, and neither logs nor counts
+  if (xlen != 64 || extension_enabled('E') || any_custom_extensions() ||
+      log_commits_enabled || insn_mix || sampler) {
+    fprintf(stderr, "warning: JIT requires RV64I without custom extensions, "
+            "commit logging, instruction counts or sampling; using the interpreter.\n");
+    return;
+  }
+
+  jit = new jit_t(this);
+}
+
+void processor_t::set_bbv(const char* path, uint64_t interval)
+{
+  delete bbv;
+  bbv = new bbv_profiler_t(path, interval);
 }
 
 #ifdef RISCV_ENABLE_COMMITLOG
@@ -560,6 +595,7 @@ void processor_t::reset()
 {
   xlen = isa->get_max_xlen();
   state.reset(this, isa->get_max_isa());
+  mmu->flush_tlb();
   state.dcsr->halt = halt_on_reset;
   halt_on_reset = false;
   VU.reset();
@@ -578,6 +614,120 @@ void processor_t::reset()
     sim->proc_reset(id);
 }
 
+void processor_t::checkpoint(checkpoint_t& c)
+{
+  c.section("hart", id);
+  c.io(state.pc);
+  c.io(state.XPR);
+  c.io(state.FPR);
+  c.io(state.serialized);
+  c.io(state.single_step);
+  c.io(halt_request);
+
+  // CSRs are accessed from M-mode with V=0, so that every address names the
+  // register itself rather than its virtualized counterpart.
+  reg_t prv = state.prv;
+  bool v = state.v;
+  bool debug_mode = state.debug_mode;
+  c.io(prv);
+  c.io(v);
+  c.io(debug_mode);
+  state.prv = PRV_M;
+  state.v = false;
+
+  // CSRs are saved in the order they are restored in.  PMP addresses go
+  // before the configuration that may lock them, and mseccfg goes last.
+  struct csr_value_t {
+    reg_t addr;
+    reg_t value;
+  };
+  std::vector<csr_value_t> csrs;
+  if (!c.restoring()) {
+    for (auto& csr : state.csrmap)
+      if (csr.first != CSR_SEED && // reading the entropy source consumes it
+          csr.first != CSR_SPIKE_FORK)
+        csrs.push_back({csr.first, csr.second->read()});
+    auto order = [](reg_t addr) {
+      int group = addr >= CSR_PMPADDR0 && addr <= CSR_PMPADDR63 ? 0 : addr == CSR_MSECCFG ? 2 : 1;
+      return std::make_pair(group, addr);
+    };
+    std::sort(csrs.begin(), csrs.end(), [&](const csr_value_t& a, const csr_value_t& b) {
+      return order(a.addr) < order(b.addr);
+    });
+  }
+  c.io(csrs);
+  reg_t minstret = state.minstret->read();
+  reg_t mcycle = state.mcycle->read();
+  reg_t mip = state.mip->read();
+  c.io(minstret);
+  c.io(mcycle);
+  c.io(mip);
+  c.io(state.dcsr->cause);
+  c.io(state.dcsr->halt);
+
+  if (c.restoring()) {
+    // the legal values of some CSRs depend on others (e.g. misa and the
+    // state-enable registers), so write them all twice.  the floating-point
+    // and vector CSRs can only be written while mstatus enables them, and
+    // they come before mstatus, which puts FS and VS back.
+    for (int pass = 0; pass < 2; pass++) {
+      state.mstatus->write(state.mstatus->read() | MSTATUS_FS | MSTATUS_VS);
+      for (auto& csr : csrs) {
+        auto search = state.csrmap.find(csr.addr);
+        if (search == state.csrmap.end())
+          c.mismatch("hart " + std::to_string(id) + " has no CSR " + std::to_string(csr.addr));
+        search->second->write(csr.value);
+      }
+    }
+
+    // writes to the counters are corrected for the increment that follows
+    // the instruction that writes them
+    state.minstret->write(minstret);
+    state.minstret->bump(1);
+    state.mcycle->write(mcycle);
+    state.mcycle->bump(1);
+    state.mip->backdoor_write_with_mask(~reg_t(0), mip);
+  }
+
+  // triggers with dmode set can only be written in debug mode
+  c.section("triggers", TM.count());
+  state.debug_mode = true;
+  for (unsigned i = 0; i < TM.count(); i++) {
+    reg_t tdata1 = TM.tdata1_read(this, i);
+    reg_t tdata2 = TM.tdata2_read(this, i);
+    c.io(tdata1);
+    c.io(tdata2);
+    if (c.restoring()) {
+      TM.tdata2_write(this, i, tdata2);
+      TM.tdata1_write(this, i, tdata1);
+    }
+  }
+
+  if (extension_enabled('V')) {
+    c.section("vector", NVPR * VU.vlenb);
+    c.io(VU.reg_file, NVPR * VU.vlenb);
+    reg_t vl = VU.vl->read();
+    reg_t vtype = VU.vtype->read();
+    reg_t vstart = VU.vstart->read();
+    c.io(vl);
+    c.io(vtype);
+    c.io(vstart);
+    if (c.restoring()) {
+      VU.set_vl(1, 1, vl, vtype);
+      VU.vstart->write_raw(vstart);
+    }
+  }
+
+  state.prv = prv;
+  state.v = v;
+  state.debug_mode = debug_mode;
+#ifdef RISCV_ENABLE_COMMITLOG
+  if (c.restoring())
+    state.log_reg_write.clear();
+#endif
+  mmu->checkpoint(c);
+}
+
 extension_t* processor_t::get_extension()
 {
   switch (custom_extensions.size()) {
@@ -716,8 +866,8 @@ reg_t processor_t::legalize_privilege(reg_t prv)
 
 void processor_t::set_privilege(reg_t prv)
 {
-  mmu->flush_tlb();
   state.prv = legalize_privilege(prv);
+  mmu->switch_tlb_context();
 }
 
 void processor_t::set_virt(bool virt)
@@ -729,14 +879,11 @@ void processor_t::set_virt(bool virt)
 
   if (state.v != virt) {
     /*
-     * Ideally, we should flush TLB here but we don't need it because
-     * set_virt() is always used in conjucter with set_privilege() and
-     * set_privilege() will flush TLB unconditionally.
-     *
-     * The virtualized sstatus register also relies on this TLB flush,
-     * since changing V might change sstatus.MXR and sstatus.SUM.
+     * The TLB context includes V, and with it the virtualized satp and
+     * sstatus.MXR/SUM, so switch to the context of the new mode.
      */
     state.v = virt;
+    mmu->switch_tlb_context();
   }
 }
 
@@ -934,6 +1081,16 @@ reg_t illegal_instruction(processor_t* p, insn_t insn, reg_t pc)
   throw trap_illegal_instruction(insn.bits());
 }
 
+static size_t decode_bucket(insn_bits_t bits)
+{
+  return (bits & 0x7f) | ((bits >> 12) & 0x7) << 7;
+}
+
+static size_t decode_split_bucket(insn_bits_t bits)
+{
+  return (bits >> 25) & 0x7f;
+}
+
 insn_func_t processor_t::decode_insn(insn_t insn)
 {
   // look up opcode in hash table
@@ -943,33 +1100,48 @@ insn_func_t processor_t::decode_insn(insn_t insn)
   bool rve = extension_enabled('E');
 
   if (unlikely(insn.bits() != desc.match)) {
-    // fall back to linear search
-    int cnt = 0;
-    insn_desc_t* p = &instructions[0];
-    while ((insn.bits() & p->mask) != p->match)
-      p++, cnt++;
-    desc = *p;
-
-    if (p->mask != 0 && p > &instructions[0]) {
-      if (p->match != (p - 1)->match && p->match != (p + 1)->match) {
-        // move to front of opcode list to reduce miss penalty
-        while (--p >= &instructions[0])
-          *(p + 1) = *p;
-        instructions[0] = desc;
-      }
-    }
+    // fall back to searching the instructions compatible with the opcode
+    opcode_cache_misses++;
+    desc = instructions[find_insn(insn.bits(), &decode_comparisons)];
 
     opcode_cache[idx] = desc;
     opcode_cache[idx].match = insn.bits();
+  } else {
+    opcode_cache_hits++;
   }
 
   return desc.func(xlen, rve);
 }
 
+// the index in instructions of the first instruction, in priority order,
+// that bits matches.  adds the number of instructions tried to *comparisons.
+uint32_t processor_t::find_insn(insn_bits_t bits, uint64_t* comparisons) const
+{
+  const decode_bucket_t* bucket = &decode_buckets[decode_bucket(bits)];
+  if (bucket->split != uint32_t(-1))
+    bucket = &decode_split_buckets[bucket->split + decode_split_bucket(bits)];
+  const uint32_t* candidate = &decode_candidates[bucket->begin];
+  while ((bits & instructions[*candidate].mask) != instructions[*candidate].match)
+    candidate++;
+  if (comparisons)
+    *comparisons += candidate - &decode_candidates[bucket->begin] + 1;
+  return *candidate;
+}
+
+uint32_t processor_t::get_insn_id(insn_t insn) const
+{
+  return instructions[find_insn(insn.bits())].id;
+}
+
+// instructions are numbered in the order they are registered, so the ids of
+// a hart's instructions are 0 to instructions.size() - 1, and profilers can
+// keep per-instruction statistics in flat arrays.  build_opcode_map() sorts
+// instructions, but the ids stay with them.
 void processor_t::register_insn(insn_desc_t desc)
 {
   assert(desc.rv32i && desc.rv64i && desc.rv32e && desc.rv64e);
 
+  desc.id = instructions.size();
   instructions.push_back(desc);
 }
 
@@ -986,6 +1158,52 @@ void processor_t::build_opcode_map()
 
   for (size_t i = 0; i < OPCODE_CACHE_SIZE; i++)
     opcode_cache[i] = insn_desc_t::illegal();
+
+  // an instruction can only match an encoding if it agrees with it on the
+  // bits it shares with the bucket's key.  the list keeps the instructions
+  // in priority order, and every list ends with the catch-all.
+  auto add_bucket = [this](insn_bits_t key, insn_bits_t key_mask) {
+    decode_bucket_t bucket = {uint32_t(decode_candidates.size()), 0, uint32_t(-1)};
+    for (size_t i = 0; i < instructions.size(); i++)
+      if (((instructions[i].match ^ key) & instructions[i].mask & key_mask) == 0)
+        decode_candidates.push_back(i);
+    bucket.end = decode_candidates.size();
+    return bucket;
+  };
+
+  decode_split_buckets.clear();
+  decode_candidates.clear();
+  for (size_t i = 0; i < DECODE_BUCKETS; i++) {
+    insn_bits_t key = (i & 0x7f) | (insn_bits_t(i >> 7) << 12);
+    insn_bits_t key_mask = 0x707f;
+    decode_buckets[i] = add_bucket(key, key_mask);
+    if (decode_buckets[i].end - decode_buckets[i].begin > DECODE_SPLIT_THRESHOLD) {
+      decode_candidates.resize(decode_buckets[i].begin);
+      decode_buckets[i].end = decode_buckets[i].begin;
+      decode_buckets[i].split = decode_split_buckets.size();
+      for (size_t j = 0; j < DECODE_SPLIT_BUCKETS; j++)
+        decode_split_buckets.push_back(add_bucket(key | (insn_bits_t(j) << 25), key_mask | 0xfe000000));
+    }
+  }
+}
+
+void processor_t::print_decode_stats() const
+{
+  uint64_t lookups = opcode_cache_hits + opcode_cache_misses;
+  if (lookups == 0)
+    return;
+
+  printf("Decode%u Cache Hits:          %" PRIu64 "\n", id, opcode_cache_hits);
+  printf("Decode%u Cache Misses:        %" PRIu64 "\n", id, opcode_cache_misses);
+  printf("Decode%u Cache Hit Rate:      %.3f%%\n", id, 100.0 * opcode_cache_hits / lookups);
+  if (opcode_cache_misses)
+    printf("Decode%u Compares per Miss:   %.3f\n", id, double(decode_comparisons) / opcode_cache_misses);
+}
+
+void processor_t::print_insn_mix() const
+{
+  if (insn_mix)
+    insn_mix->print_mix();
 }
 
 void processor_t::register_extension(extension_t* x)
@@ -1034,6 +1252,23 @@ void processor_t::register_base_instructions()
   #include "insn_list.h"
   #undef DEFINE_INSN
 
+  // swap in the handlers that read pre-decoded operands for the hot ones
+  #define DEFINE_PREDECODED_INSN(name) \
+    extern reg_t rv32i_predecoded_##name(processor_t*, insn_t, reg_t); \
+    extern reg_t rv64i_predecoded_##name(processor_t*, insn_t, reg_t); \
+    extern reg_t rv32e_predecoded_##name(processor_t*, insn_t, reg_t); \
+    extern reg_t rv64e_predecoded_##name(processor_t*, insn_t, reg_t); \
+    for (auto& desc : instructions) { \
+      if (desc.match == name##_match && desc.mask == name##_mask) { \
+        desc.rv32i = rv32i_predecoded_##name; \
+        desc.rv64i = rv64i_predecoded_##name; \
+        desc.rv32e = rv32e_predecoded_##name; \
+        desc.rv64e = rv64e_predecoded_##name; \
+      } \
+    }
+  #include "predecoded_insn_list.h"
+  #undef DEFINE_PREDECODED_INSN
+
   // terminate instruction list with a catch-all
   register_insn(insn_desc_t::illegal());
 
@@ -10,20 +10,28 @@
 #include <vector>
 #include <unordered_map>
 #include <map>
+#include <bitset>
 #include <cassert>
 #include "debug_rom_defines.h"
 #include "entropy_source.h"
 #include "csrs.h"
 #include "isa_parser.h"
 #include "triggers.h"
+#include "profiler.h"
 
 class processor_t;
 class mmu_t;
+class jit_t;
+class bbv_profiler_t;
+class insn_mix_t;
+class hart_sampler_t;
+class commit_log_ring_t;
 typedef reg_t (*insn_func_t)(processor_t*, insn_t, reg_t);
 class simif_t;
 class trap_t;
 class extension_t;
 class disassembler_t;
+class checkpoint_t;
 
 reg_t illegal_instruction(processor_t* p, insn_t insn, reg_t pc);
 
@@ -35,6 +43,7 @@ struct insn_desc_t
   insn_func_t rv64i;
   insn_func_t rv32e;
   insn_func_t rv64e;
+  uint32_t id; // dense index among a hart's instructions; see register_insn()
 
   insn_func_t func(int xlen, bool rve)
   {
@@ -50,11 +59,112 @@ struct insn_desc_t
   }
 };
 
-// regnum, data
-typedef std::unordered_map<reg_t, freg_t> commit_log_reg_t;
+// the instructions an encoding can decode to, in priority order.  see
+// processor_t::build_opcode_map().
+struct decode_bucket_t
+{
+  uint32_t begin; // range of processor_t::decode_candidates
+  uint32_t end;
+  uint32_t split; // first of the sub-buckets indexed by funct7, or -1
+};
+
+// a custom user CSR added when the simulator is set to fork (see
+// sim_t::set_fork).  it controls the simulator rather than being hart
+// state, so it is not checkpointed.
+#define CSR_SPIKE_FORK 0x8ff
+
+// The registers one instruction wrote, for the commit log: a map from
+// regnum (the register number << 4 | its kind, see WRITE_REG) to the data
+// written, which iterates in the order the registers were first written.
+// It lives in fixed arrays, so that the interpreter can clear and fill it for
+// every instruction without allocating.
+class commit_log_reg_t
+{
+public:
+  typedef std::pair<reg_t, freg_t> value_type;
+
+  commit_log_reg_t() : n(0) {}
+
+  freg_t& operator[](reg_t regnum)
+  {
+    // integer, floating-point and vector registers are found by a bitmap,
+    // and only the rare rewrites of one of them need a search
+    reg_t kind = regnum & 0xf, reg = regnum >> 4;
+    if (kind < 3 && reg < 32 && !written[kind * 32 + reg]) {
+      written[kind * 32 + reg] = true;
+      return append(regnum);
+    }
+    for (size_t i = 0; i < n; i++)
+      if (entries[i].first == regnum)
+        return entries[i].second;
+    return append(regnum);
+  }
+
+  void clear()
+  {
+    if (n != 0) {
+      n = 0;
+      written.reset();
+    }
+  }
+
+  size_t size() const { return n; }
+  size_t count(reg_t regnum) const
+  {
+    for (size_t i = 0; i < n; i++)
+      if (entries[i].first == regnum)
+        return 1;
+    return 0;
+  }
+  const value_type* begin() const { return entries; }
+  const value_type* end() const { return entries + n; }
+
+private:
+  // every integer, floating-point and vector register, the vector hint and
+  // as many CSRs as a trap writes, with room to spare
+  static const size_t CAPACITY = 32 * 3 + 1 + 31;
+
+  size_t n;
+  std::bitset<32 * 3> written;
+  value_type entries[CAPACITY];
+
+  freg_t& append(reg_t regnum)
+  {
+    assert(n < CAPACITY);
+    entries[n].first = regnum;
+    return entries[n++].second;
+  }
+};
 
 // addr, value, size
-typedef std::vector<std::tuple<reg_t, uint64_t, uint8_t>> commit_log_mem_t;
+typedef std::tuple<reg_t, uint64_t, uint8_t> commit_log_mem_item_t;
+
+// The memory accesses of one instruction, for the commit log, in a fixed
+// array like commit_log_reg_t.
+class commit_log_mem_t
+{
+public:
+  commit_log_mem_t() : n(0) {}
+
+  void push_back(const commit_log_mem_item_t& item)
+  {
+    assert(n < CAPACITY);
+    items[n++] = item;
+  }
+
+  void clear() { n = 0; }
+  size_t size() const { return n; }
+  const commit_log_mem_item_t* begin() const { return items; }
+  const commit_log_mem_item_t* end() const { return items + n; }
+
+private:
+  // a vector access of eight registers of the longest VLEN (4096 bits), one
+  // byte at a time
+  static const size_t CAPACITY = 8 * 4096 / 8;
+
+  size_t n;
+  commit_log_mem_item_t items[CAPACITY];
+};
 
 enum VRM{
   RNU = 0,
@@ -242,12 +352,34 @@ public:
 
   void set_debug(bool value);
   void set_histogram(bool value);
+  // count the instructions executed, by opcode and, if by_mode is set, by
+  // privilege mode, for print_insn_mix()
+  void set_insn_mix(bool by_mode);
+  insn_mix_t* get_insn_mix() { return insn_mix; }
+  void set_jit(bool value);
+  // write basic-block vectors for every interval instructions to path
+  void set_bbv(const char* path, uint64_t interval);
+  // report the instructions this hart retires to sampler, which the caller
+  // owns, or to none if it is NULL
+  void set_sampler(hart_sampler_t* sampler) { this->sampler = sampler; }
+  hart_sampler_t* get_sampler() { return sampler; }
+  // observe every instruction this hart retires (see insn_profiler_t)
+  void register_profiler(insn_profiler_t* profiler) { profilers.hook(profiler); }
+  void unregister_profiler(insn_profiler_t* profiler) { profilers.unhook(profiler); }
+  insn_profiler_list_t& get_profilers() { return profilers; }
+  // the id of the instruction insn decodes to, without going through (or
+  // counting in the statistics of) the opcode cache
+  uint32_t get_insn_id(insn_t insn) const;
 #ifdef RISCV_ENABLE_COMMITLOG
   void enable_log_commits();
   bool get_log_commits_enabled() const { return log_commits_enabled; }
+  // record commits in binary form in ring rather than as text
+  void set_commit_log_ring(commit_log_ring_t* ring) { commit_log_ring = ring; }
+  commit_log_ring_t* get_commit_log_ring() { return commit_log_ring; }
 #endif
   void reset();
   void step(size_t n); // run for n cycles
+  void checkpoint(checkpoint_t& c);
   void put_csr(int which, reg_t val);
   uint32_t get_id() const { return id; }
   reg_t get_csr(int which, insn_t insn, bool write, bool peek = 0);
@@ -300,7 +432,6 @@ public:
   reg_t legalize_privilege(reg_t);
   void set_privilege(reg_t);
   void set_virt(bool);
-  void update_histogram(reg_t pc);
   const disassembler_t* get_disassembler() { return disassembler; }
 
   FILE *get_log_file() { return log_file; }
@@ -331,11 +462,19 @@ public:
 
   const char* get_symbol(uint64_t addr);
 
+  void print_decode_stats() const;
+  void print_insn_mix() const;
+
 private:
   const isa_parser_t * const isa;
 
   simif_t* sim;
   mmu_t* mmu; // main memory is always accessed via the mmu
+  jit_t* jit; // translates hot blocks to native code; NULL if disabled
+  bbv_profiler_t* bbv; // NULL if disabled
+  insn_mix_t* insn_mix; // counts for --insn-mix and -g; NULL if neither
+  hart_sampler_t* sampler; // NULL if not sampling
+  insn_profiler_list_t profilers;
   std::unordered_map<std::string, extension_t*> custom_extensions;
   disassembler_t* disassembler;
   state_t state;
@@ -344,15 +483,29 @@ private:
   bool histogram_enabled;
   bool log_commits_enabled;
   FILE *log_file;
+  commit_log_ring_t* commit_log_ring; // NULL unless the commit log is binary
   std::ostream sout_; // needed for socket command interface -s, also used for -d and -l, but not for --log
   bool halt_on_reset;
   std::vector<bool> impl_table;
 
   std::vector<insn_desc_t> instructions;
-  std::map<reg_t,uint64_t> pc_histogram;
 
   static const size_t OPCODE_CACHE_SIZE = 8191;
   insn_desc_t opcode_cache[OPCODE_CACHE_SIZE];
+  uint64_t opcode_cache_hits;
+  uint64_t opcode_cache_misses;
+  uint64_t decode_comparisons; // of an encoding with an instruction on misses
+
+  // the decode engine behind opcode_cache.  an encoding's bucket is chosen
+  // by its major opcode and funct3 bits, and lists the instructions whose
+  // match and mask are compatible with those bits.  buckets with more than
+  // DECODE_SPLIT_THRESHOLD instructions are split again by funct7.
+  static const size_t DECODE_BUCKETS = 1 << 10;
+  static const size_t DECODE_SPLIT_BUCKETS = 1 << 7;
+  static const size_t DECODE_SPLIT_THRESHOLD = 8;
+  decode_bucket_t decode_buckets[DECODE_BUCKETS];
+  std::vector<decode_bucket_t> decode_split_buckets;
+  std::vector<uint32_t> decode_candidates; // indices into instructions
 
   void take_pending_interrupt() { take_interrupt(state.mip->read() & state.mie->read()); }
   void take_interrupt(reg_t mask); // take first enabled interrupt in mask
@@ -373,6 +526,7 @@ private:
   void build_opcode_map();
   void register_base_instructions();
   insn_func_t decode_insn(insn_t insn);
+  uint32_t find_insn(insn_bits_t bits, uint64_t* comparisons = NULL) const;
 
   // Track repeated executions for processor_t::disasm()
   uint64_t last_pc, last_bits, executions;
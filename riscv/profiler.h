@@ -0,0 +1,56 @@
+// See LICENSE for license details.
+
+#ifndef _RISCV_PROFILER_H
+#define _RISCV_PROFILER_H
+
+#include "decode.h"
+#include <algorithm>
+#include <vector>
+
+class processor_t;
+
+// Observes the instructions a hart retires.  While any profiler is hooked,
+// the hart runs a separate instantiation of its interpreter loop that calls
+// issue() before and retire() after every instruction (and never the JIT),
+// so profilers cost nothing while none is hooked.  An instruction that traps
+// is issued but does not retire.
+class insn_profiler_t
+{
+ public:
+  insn_profiler_t() {}
+  virtual ~insn_profiler_t() {}
+
+  // insn at pc is about to execute
+  virtual void issue(processor_t* p, reg_t pc, insn_t insn) {}
+
+  // insn at pc retired, and the hart goes on to npc
+  virtual void retire(processor_t* p, reg_t pc, insn_t insn, reg_t npc) = 0;
+};
+
+class insn_profiler_list_t : public insn_profiler_t
+{
+ public:
+  bool empty() { return list.empty(); }
+  void issue(processor_t* p, reg_t pc, insn_t insn)
+  {
+    for (auto it: list)
+      it->issue(p, pc, insn);
+  }
+  void retire(processor_t* p, reg_t pc, insn_t insn, reg_t npc)
+  {
+    for (auto it: list)
+      it->retire(p, pc, insn, npc);
+  }
+  void hook(insn_profiler_t* h)
+  {
+    list.push_back(h);
+  }
+  void unhook(insn_profiler_t* h)
+  {
+    list.erase(std::remove(list.begin(), list.end(), h), list.end());
+  }
+ private:
+  std::vector<insn_profiler_t*> list;
+};
+
+#endif
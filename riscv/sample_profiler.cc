@@ -0,0 +1,172 @@
+// See LICENSE for license details.
+
+#include "sample_profiler.h"
+#include "branch_profiler.h"
+#include "processor.h"
+#include "simif.h"
+#include <errno.h>
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <iterator>
+
+hart_sampler_t::hart_sampler_t(simif_t* sim, uint64_t interval)
+  : sim(sim), interval(interval), lfsr(1), samples(0)
+{
+  countdown = next_interval();
+}
+
+uint64_t hart_sampler_t::next_interval()
+{
+  // uniform within an eighth of the interval either way
+  lfsr = (lfsr >> 1) ^ (-(lfsr & 1) & 0xd0000001);
+  uint64_t spread = interval / 4;
+  return interval - spread / 2 + lfsr % (spread + 1);
+}
+
+void hart_sampler_t::sample(reg_t pc, insn_fetch_t* insns, size_t n)
+{
+  // take a sample at each instruction at which the countdown runs out.
+  // done counts the instructions accounted for, and pc is that of the
+  // at-th instruction.
+  size_t done = 0, at = 0;
+  while (countdown <= n - done) {
+    done += countdown;
+    for ( ; at < done - 1; at++)
+      pc += insns[at].insn.length();
+    take_sample(pc);
+    countdown = next_interval();
+  }
+  countdown -= n - done;
+}
+
+std::string hart_sampler_t::function(reg_t addr)
+{
+  const char* name = sim->get_function(addr);
+  return name ? name : "[unknown]";
+}
+
+void hart_sampler_t::take_sample(reg_t pc)
+{
+  // a return address belongs to the function of the call before it
+  std::vector<std::string> frames;
+  for (auto addr : stack)
+    frames.push_back(function(addr - 2));
+  frames.push_back(function(pc));
+
+  std::string folded;
+  for (auto& frame : frames)
+    folded += (folded.empty() ? "" : ";") + frame;
+  stacks[folded]++;
+  self[frames.back()]++;
+
+  // count recursive functions once per sample
+  std::sort(frames.begin(), frames.end());
+  frames.erase(std::unique(frames.begin(), frames.end()), frames.end());
+  for (auto& frame : frames)
+    total[frame]++;
+  samples++;
+}
+
+void hart_sampler_t::track_call(processor_t* p, insn_t insn, reg_t npc)
+{
+  switch (branch_profiler_t::classify(insn, p->get_xlen())) {
+    case branch_profiler_t::CALL: {
+      // the link register holds the return address
+      unsigned link = insn.length() == 2 ? 1 : insn.rd();
+      if (stack.size() == MAX_DEPTH)
+        stack.erase(stack.begin());
+      stack.push_back(p->get_state()->XPR[link]);
+      break;
+    }
+    case branch_profiler_t::RET: {
+      // a return may skip frames, e.g. after a longjmp
+      auto it = std::find(stack.rbegin(), stack.rend(), npc);
+      if (it != stack.rend())
+        stack.erase(std::prev(it.base()), stack.end());
+      else if (!stack.empty())
+        stack.pop_back();
+      break;
+    }
+  }
+}
+
+sample_profiler_t::sample_profiler_t(simif_t* sim, const char* path, uint64_t interval,
+                                     size_t nharts)
+  : interval(interval)
+{
+  file = fopen(path, "w");
+  if (!file) {
+    fprintf(stderr, "could not open sample profile %s: %s\n", path, strerror(errno));
+    exit(1);
+  }
+
+  for (size_t i = 0; i < nharts; i++)
+    harts.emplace_back(new hart_sampler_t(sim, interval));
+}
+
+sample_profiler_t::~sample_profiler_t()
+{
+  uint64_t samples = 0;
+  std::unordered_map<std::string, uint64_t> stacks, self, total;
+  for (size_t i = 0; i < harts.size(); i++) {
+    const hart_sampler_t& hart = *harts[i];
+    samples += hart.samples;
+    for (auto& entry : hart.self)
+      self[entry.first] += entry.second;
+    for (auto& entry : hart.total)
+      total[entry.first] += entry.second;
+
+    // keep the harts apart in the flame graph
+    std::string root = harts.size() > 1 ? "hart" + std::to_string(i) + ";" : "";
+    for (auto& entry : hart.stacks)
+      stacks[root + entry.first] += entry.second;
+  }
+
+  std::vector<std::pair<std::string, uint64_t>> lines(stacks.begin(), stacks.end());
+  std::sort(lines.begin(), lines.end());
+  for (auto& line : lines)
+    fprintf(file, "%s %" PRIu64 "\n", line.first.c_str(), line.second);
+  fclose(file);
+
+  print("all harts", samples, self, total);
+  if (harts.size() > 1) {
+    for (size_t i = 0; i < harts.size(); i++) {
+      std::string title = "hart " + std::to_string(i);
+      print(title.c_str(), harts[i]->samples, harts[i]->self, harts[i]->total);
+    }
+  }
+}
+
+void sample_profiler_t::print(const char* title, uint64_t samples,
+                              const std::unordered_map<std::string, uint64_t>& self,
+                              const std::unordered_map<std::string, uint64_t>& total)
+{
+  printf("Profile of %s: %" PRIu64 " samples, one every %" PRIu64
+         " instructions on average\n",
+         title, samples, interval);
+  if (samples == 0)
+    return;
+
+  // functions by samples in them, then by samples under them
+  std::vector<std::pair<std::string, uint64_t>> functions(total.begin(), total.end());
+  auto self_samples = [&](const std::string& name) {
+    auto it = self.find(name);
+    return it == self.end() ? 0 : it->second;
+  };
+  std::sort(functions.begin(), functions.end(),
+            [&](const std::pair<std::string, uint64_t>& a, const std::pair<std::string, uint64_t>& b) {
+    uint64_t self_a = self_samples(a.first), self_b = self_samples(b.first);
+    if (self_a != self_b)
+      return self_a > self_b;
+    return a.second != b.second ? a.second > b.second : a.first < b.first;
+  });
+
+  printf("  %7s %7s %14s  %s\n", "self%", "total%", "self", "function");
+  for (auto& function : functions) {
+    uint64_t n = self_samples(function.first);
+    printf("  %6.2f%% %6.2f%% %14" PRIu64 "  %s\n", 100.0 * n / samples,
+           100.0 * function.second / samples, n, function.first.c_str());
+  }
+}
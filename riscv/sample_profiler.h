@@ -0,0 +1,89 @@
+// See LICENSE for license details.
+
+#ifndef _RISCV_SAMPLE_PROFILER_H
+#define _RISCV_SAMPLE_PROFILER_H
+
+#include "mmu.h"
+#include <stdio.h>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+class simif_t;
+
+// The samples of one hart.  Every interval instructions it notes which
+// function the hart is in, and the functions that called it, which it tracks
+// in a shadow call stack of the calls and returns the hart executes.  The
+// interval varies a little around its mean, so that samples do not fall in
+// step with a loop whose length divides it.
+// Functions are found by address in the symbol ranges of the loaded ELF (see
+// simif_t::get_function()), so the program needs no instrumentation.
+class hart_sampler_t
+{
+public:
+  hart_sampler_t(simif_t* sim, uint64_t interval);
+
+  // the first n of the instructions at pc retired, and the hart went on to
+  // npc
+  void record(processor_t* p, reg_t pc, insn_fetch_t* insns, size_t n, reg_t npc)
+  {
+    if (unlikely(n == 0))
+      return;
+    if (unlikely(n >= countdown))
+      sample(pc, insns, n);
+    else
+      countdown -= n;
+    insn_bits_t last = insns[n - 1].insn.bits();
+    // only jal, jalr and compressed jumps call or return
+    if ((last & 0x77) == 0x67 || (last & 0x3) != 0x3)
+      track_call(p, insns[n - 1].insn, npc);
+  }
+
+private:
+  friend class sample_profiler_t;
+
+  simif_t* sim;
+  uint64_t interval;
+  uint64_t countdown; // instructions until the next sample
+  uint32_t lfsr; // for the variation of the interval
+  uint64_t samples;
+  std::vector<reg_t> stack; // return addresses, innermost last
+  std::unordered_map<std::string, uint64_t> stacks; // samples by folded stack
+  std::unordered_map<std::string, uint64_t> self; // samples by innermost function
+  std::unordered_map<std::string, uint64_t> total; // samples by function on the stack
+
+  static const size_t MAX_DEPTH = 1024;
+
+  uint64_t next_interval();
+  void sample(reg_t pc, insn_fetch_t* insns, size_t n);
+  void take_sample(reg_t pc);
+  void track_call(processor_t* p, insn_t insn, reg_t npc);
+  std::string function(reg_t addr);
+};
+
+// A sampling profiler of hot regions.  On destruction it prints a flat
+// profile of all harts and, if there are several, one of each hart, and
+// writes the sampled call stacks in the folded format that flame graph
+// tools (e.g. flamegraph.pl) read: one line per distinct stack, its
+// functions outermost first, separated by semicolons, then its count.
+class sample_profiler_t
+{
+public:
+  // open path, exiting with an error message on failure
+  sample_profiler_t(simif_t* sim, const char* path, uint64_t interval, size_t nharts);
+  ~sample_profiler_t();
+
+  hart_sampler_t* get_hart(size_t i) { return harts[i].get(); }
+
+private:
+  FILE* file;
+  uint64_t interval;
+  std::vector<std::unique_ptr<hart_sampler_t>> harts;
+
+  void print(const char* title, uint64_t samples,
+             const std::unordered_map<std::string, uint64_t>& self,
+             const std::unordered_map<std::string, uint64_t>& total);
+};
+
+#endif
@@ -3,10 +3,12 @@
 #include "sim.h"
 #include "mmu.h"
 #include "dts.h"
+#include "checkpoint.h"
 #include "remote_bitbang.h"
 #include "byteorder.h"
 #include "platform.h"
 #include "libfdt.h"
+#include <algorithm>
 #include <fstream>
 #include <map>
 #include <iostream>
@@ -14,6 +16,8 @@
 #include <climits>
 #include <cstdlib>
 #include <cassert>
+#include <errno.h>
+#include <string.h>
 #include <signal.h>
 #include <unistd.h>
 #include <sys/wait.h>
@@ -56,10 +60,19 @@ sim_t::sim_t(const cfg_t *cfg, bool halted,
     sout_(nullptr),
     current_step(0),
     current_proc(0),
+    checkpoint_save_instret(0),
+    fork_instret(-1),
+    fork_children(0),
+    fork_index(0),
     debug(false),
     histogram_enabled(false),
     log(false),
     remote_bitbang(NULL),
+    parallel(false),
+    hart_epoch(0),
+    hart_quantum(0),
+    harts_running(0),
+    harts_exit(false),
     debug_module(this, dm_config)
 {
   signal(SIGINT, &handle_signal);
@@ -171,6 +184,14 @@ sim_t::sim_t(const cfg_t *cfg, bool halted,
 
 sim_t::~sim_t()
 {
+  {
+    std::lock_guard<std::mutex> lock(hart_mutex);
+    harts_exit = true;
+  }
+  hart_start.notify_all();
+  for (auto& t : hart_threads)
+    t.join();
+
   for (size_t i = 0; i < procs.size(); i++)
     delete procs[i];
   delete debug_mmu;
@@ -190,8 +211,10 @@ void sim_t::main()
   {
     if (debug || ctrlc_pressed)
       interactive();
+    else if (parallel)
+      step_parallel(INTERLEAVE);
     else
-      step(INTERLEAVE);
+      step(INTERLEAVE - current_step); // less if resuming mid-quantum
     if (remote_bitbang) {
       remote_bitbang->tick();
     }
@@ -210,6 +233,22 @@ void sim_t::step(size_t n)
   for (size_t i = 0, steps = 0; i < n; i += steps)
   {
     steps = std::min(n - i, INTERLEAVE - current_step);
+    if (!checkpoint_save_path.empty() || fork_instret != reg_t(-1)) {
+      reg_t instret = procs[0]->get_state()->minstret->read();
+      if (!checkpoint_save_path.empty() && instret >= checkpoint_save_instret) {
+        checkpoint_t c(checkpoint_save_path.c_str(), false);
+        checkpoint(c);
+        checkpoint_save_path.clear();
+      }
+      if (instret >= fork_instret)
+        fork_now();
+
+      // stop hart 0 at the instruction the next of them is due at
+      reg_t due = checkpoint_save_path.empty() ? fork_instret : std::min(fork_instret, checkpoint_save_instret);
+      if (current_proc == 0 && due != reg_t(-1))
+        steps = std::min<reg_t>(steps, due - instret);
+    }
+
     procs[current_proc]->step(steps);
 
     current_step += steps;
@@ -227,6 +266,165 @@ void sim_t::step(size_t n)
   }
 }
 
+void sim_t::hart_thread_main(size_t i)
+{
+  uint64_t epoch = 0;
+  while (true) {
+    size_t n;
+    {
+      std::unique_lock<std::mutex> lock(hart_mutex);
+      hart_start.wait(lock, [&]{ return harts_exit || hart_epoch != epoch; });
+      if (harts_exit)
+        return;
+      epoch = hart_epoch;
+      n = hart_quantum;
+    }
+
+    procs[i]->step(n);
+
+    std::lock_guard<std::mutex> lock(hart_mutex);
+    if (--harts_running == 0)
+      hart_done.notify_one();
+  }
+}
+
+void sim_t::step_parallel(size_t n)
+{
+  if (hart_threads.empty()) {
+    for (size_t i = 0; i < procs.size(); i++)
+      hart_threads.emplace_back(&sim_t::hart_thread_main, this, i);
+  }
+
+  // every hart runs a quantum of n instructions on its own thread
+  {
+    std::unique_lock<std::mutex> lock(hart_mutex);
+    hart_quantum = n;
+    harts_running = procs.size();
+    hart_epoch++;
+    hart_start.notify_all();
+    hart_done.wait(lock, [&]{ return harts_running == 0; });
+  }
+
+  // all harts are now stopped at the quantum barrier
+  for (size_t i = 0; i < procs.size(); i++)
+    procs[i]->get_mmu()->yield_load_reservation();
+  if (clint) clint->increment(n / INSNS_PER_RTC_TICK);
+
+  host->switch_to();
+}
+
+void sim_t::set_parallel(bool value)
+{
+  parallel = value;
+  for (size_t i = 0; i < procs.size(); i++)
+    procs[i]->get_mmu()->set_host_atomics(value);
+}
+
+void sim_t::set_checkpoint_save(const char* path, reg_t instret)
+{
+  checkpoint_save_path = path;
+  checkpoint_save_instret = instret;
+}
+
+void sim_t::set_checkpoint_restore(const char* path)
+{
+  checkpoint_restore_path = path;
+}
+
+// the state of the host (e.g. files the target program opened through
+// htif), of MMIO plugins, which have no interface for saving it, and of
+// cache models is not part of a checkpoint.
+void sim_t::checkpoint(checkpoint_t& c)
+{
+  c.section("machine", procs.size());
+  c.io(current_step);
+  c.io(current_proc);
+
+  for (auto& mem : mems) {
+    c.section("memory", mem.first);
+    mem.second->checkpoint(c);
+  }
+
+  if (clint)
+    clint->checkpoint(c);
+  debug_module.checkpoint(c);
+
+  // harts go last, after the memory their reservations point into
+  for (auto proc : procs)
+    proc->checkpoint(c);
+  c.section("end");
+
+  if (c.restoring())
+    debug_mmu->flush_tlb();
+}
+
+// reads as the number of the child the hart runs in, or 0 before the fork.
+// the first write forks.
+class fork_csr_t : public csr_t {
+ public:
+  fork_csr_t(processor_t* const proc, sim_t* sim) : csr_t(proc, CSR_SPIKE_FORK), sim(sim) {}
+  reg_t read() const noexcept override { return sim->fork_index; }
+
+ protected:
+  bool unlogged_write(const reg_t val) noexcept override
+  {
+    if (sim->fork_index == 0)
+      sim->fork_now();
+    return false;
+  }
+
+ private:
+  sim_t* const sim;
+};
+
+void sim_t::set_fork(reg_t instret, size_t children, std::function<void(size_t)> setup_child)
+{
+  fork_instret = instret;
+  fork_children = children;
+  fork_setup = setup_child;
+  for (auto proc : procs)
+    proc->get_state()->csrmap[CSR_SPIKE_FORK] = std::make_shared<fork_csr_t>(proc, this);
+}
+
+void sim_t::fork_now()
+{
+  fork_instret = -1;
+
+  // children would write out what is still buffered again
+  fflush(NULL);
+
+  std::vector<pid_t> pids;
+  for (size_t i = 1; i <= fork_children; i++) {
+    pid_t pid = fork();
+    if (pid < 0) {
+      fprintf(stderr, "could not fork child %zu: %s\n", i, strerror(errno));
+      break;
+    }
+    if (pid == 0) {
+      fork_index = i;
+      // keep each child's report in one piece rather than interleaved
+      // with the others'
+      setvbuf(stdout, NULL, _IOFBF, 1 << 16);
+      printf("Fork %zu:\n", i);
+      fork_setup(i);
+      return;
+    }
+    pids.push_back(pid);
+  }
+
+  int exit_status = pids.size() == fork_children ? 0 : 1;
+  for (auto pid : pids) {
+    int status;
+    if (waitpid(pid, &status, 0) < 0 || !WIFEXITED(status))
+      status = 1;
+    else
+      status = WEXITSTATUS(status);
+    if (exit_status == 0)
+      exit_status = status;
+  }
+  exit(exit_status);
+}
+
 void sim_t::set_debug(bool value)
 {
   debug = value;
@@ -240,6 +438,30 @@ void sim_t::set_histogram(bool value)
   }
 }
 
+void sim_t::set_insn_mix(bool by_mode)
+{
+  for (size_t i = 0; i < procs.size(); i++) {
+    procs[i]->set_insn_mix(by_mode);
+  }
+}
+
+void sim_t::set_jit(bool value)
+{
+  for (size_t i = 0; i < procs.size(); i++) {
+    procs[i]->set_jit(value);
+  }
+}
+
+void sim_t::set_bbv(const char* path, uint64_t interval)
+{
+  for (size_t i = 0; i < procs.size(); i++) {
+    std::string hart_path = path;
+    if (procs.size() > 1)
+      hart_path += "." + std::to_string(i);
+    procs[i]->set_bbv(hart_path.c_str(), interval);
+  }
+}
+
 void sim_t::configure_log(bool enable_log, bool enable_commitlog)
 {
   log = enable_log;
@@ -260,6 +482,19 @@ void sim_t::configure_log(bool enable_log, bool enable_commitlog)
 #endif
 }
 
+void sim_t::set_commit_log_binary(const char* path)
+{
+  std::vector<uint32_t> hartids;
+  for (processor_t *proc : procs)
+    hartids.push_back(proc->get_id());
+  commit_log_writer.reset(new commit_log_writer_t(path, hartids));
+
+#ifdef RISCV_ENABLE_COMMITLOG
+  for (size_t i = 0; i < procs.size(); i++)
+    procs[i]->set_commit_log_ring(commit_log_writer->get_ring(i));
+#endif
+}
+
 void sim_t::set_procs_debug(bool value)
 {
   for (size_t i=0; i< procs.size(); i++)
@@ -271,18 +506,26 @@ static bool paddr_ok(reg_t addr)
   return (addr >> MAX_PADDR_BITS) == 0;
 }
 
-bool sim_t::mmio_load(reg_t addr, size_t len, uint8_t* bytes)
+bool sim_t::mmio_load(reg_t addr, size_t len, uint8_t* bytes, size_t* hint)
 {
   if (addr + len < addr || !paddr_ok(addr + len - 1))
     return false;
-  return bus.load(addr, len, bytes);
+  auto range = bus.find_range(addr, hint);
+  if (!range)
+    return false;
+  std::lock_guard<std::mutex> lock(mmio_lock);
+  return range->dev->load(addr - range->base, len, bytes);
 }
 
-bool sim_t::mmio_store(reg_t addr, size_t len, const uint8_t* bytes)
+bool sim_t::mmio_store(reg_t addr, size_t len, const uint8_t* bytes, size_t* hint)
 {
   if (addr + len < addr || !paddr_ok(addr + len - 1))
     return false;
-  return bus.store(addr, len, bytes);
+  auto range = bus.find_range(addr, hint);
+  if (!range)
+    return false;
+  std::lock_guard<std::mutex> lock(mmio_lock);
+  return range->dev->store(addr - range->base, len, bytes);
 }
 
 void sim_t::make_dtb()
@@ -364,13 +607,15 @@ void sim_t::set_rom()
   bus.add_device(DEFAULT_RSTVEC, boot_rom.get());
 }
 
-char* sim_t::addr_to_mem(reg_t addr) {
+char* sim_t::addr_to_mem(reg_t addr, size_t* hint) {
   if (!paddr_ok(addr))
     return NULL;
-  auto desc = bus.find_device(addr);
-  if (auto mem = dynamic_cast<mem_t*>(desc.second))
-    if (addr - desc.first < mem->size())
-      return mem->contents(addr - desc.first);
+  auto range = bus.find_range(addr, hint);
+  if (range && range->mem && addr - range->base < range->mem->size()) {
+    if (char* flat = range->mem->flat_contents())
+      return flat + (addr - range->base);
+    return range->mem->contents(addr - range->base);
+  }
   return NULL;
 }
 
@@ -379,12 +624,23 @@ const char* sim_t::get_symbol(uint64_t addr)
   return htif_t::get_symbol(addr);
 }
 
+const char* sim_t::get_function(uint64_t addr)
+{
+  return htif_t::get_function(addr);
+}
+
 // htif
 
 void sim_t::reset()
 {
   if (dtb_enabled)
     set_rom();
+
+  if (!checkpoint_restore_path.empty()) {
+    checkpoint_t c(checkpoint_restore_path.c_str(), true);
+    checkpoint(c);
+    checkpoint_restore_path.clear();
+  }
 }
 
 void sim_t::idle()
@@ -431,4 +687,6 @@ memif_endianness_t sim_t::get_target_endianness() const
 void sim_t::proc_reset(unsigned id)
 {
   debug_module.proc_reset(id);
+  if (fork_children)
+    procs[id]->get_state()->csrmap[CSR_SPIKE_FORK] = std::make_shared<fork_csr_t>(procs[id], this);
 }
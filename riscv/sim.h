@@ -15,6 +15,7 @@
 #include "debug_module.h"
 #include "devices.h"
 #include "log_file.h"
+#include "commit_log.h"
 #include "processor.h"
 #include "simif.h"
 
@@ -23,6 +24,10 @@
 #include <vector>
 #include <string>
 #include <memory>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
 #include <sys/types.h>
 
 class mmu_t;
@@ -48,6 +53,35 @@ public:
   int run();
   void set_debug(bool value);
   void set_histogram(bool value);
+  void set_insn_mix(bool by_mode);
+  void set_jit(bool value);
+
+  // Write SimPoint basic-block vectors of each interval instructions to
+  // path, or to path.<n> for hart n if there are several.
+  void set_bbv(const char* path, uint64_t interval);
+
+  // Run each hart on its own host thread.  Harts still meet at a barrier
+  // every INTERLEAVE instructions, where devices and the host are serviced,
+  // but the interleaving of their memory accesses is non-deterministic.
+  void set_parallel(bool value);
+
+  // Save the whole machine to path as soon as hart 0 has retired instret
+  // instructions, then keep running.
+  void set_checkpoint_save(const char* path, reg_t instret);
+
+  // Replace the machine's state with the one saved at path when the
+  // simulation starts, after the program has been loaded.  The checkpoint
+  // must have been saved by a simulator with the same configuration.
+  void set_checkpoint_restore(const char* path);
+
+  // Fork a child process for each of children once hart 0 has retired
+  // instret instructions (never if instret is -1), or when a hart first
+  // writes CSR_SPIKE_FORK.  The children go on from a copy-on-write image of
+  // the machine, after setup_child(i) has run in child i (counting from 1),
+  // e.g. to change the cache models.  CSR_SPIKE_FORK reads as i, so that
+  // the program can also pick its input by it.  The parent waits for the
+  // children and exits with the status of the first one that failed.
+  void set_fork(reg_t instret, size_t children, std::function<void(size_t)> setup_child);
 
   // Configure logging
   //
@@ -57,6 +91,10 @@ public:
   // function will print an error message and abort).
   void configure_log(bool enable_log, bool enable_commitlog);
 
+  // Write the commit results to path in binary form, by a separate thread,
+  // rather than as text to the log file.  Needs commit logging enabled.
+  void set_commit_log_binary(const char* path);
+
   void set_procs_debug(bool value);
   void set_remote_bitbang(remote_bitbang_t* remote_bitbang) {
     this->remote_bitbang = remote_bitbang;
@@ -84,6 +122,7 @@ private:
   std::unique_ptr<clint_t> clint;
   bus_t bus;
   log_file_t log_file;
+  std::unique_ptr<commit_log_writer_t> commit_log_writer;
 
   FILE *cmd_file; // pointer to debug command input file
 
@@ -104,19 +143,46 @@ private:
   static const size_t CPU_HZ = 1000000000; // 1GHz CPU
   size_t current_step;
   size_t current_proc;
+
+  std::string checkpoint_save_path;
+  reg_t checkpoint_save_instret;
+  std::string checkpoint_restore_path;
+  void checkpoint(checkpoint_t& c);
+
+  reg_t fork_instret;
+  size_t fork_children;
+  size_t fork_index; // the child this process is, or 0 before the fork
+  std::function<void(size_t)> fork_setup;
+  void fork_now();
+  friend class fork_csr_t;
   bool debug;
   bool histogram_enabled; // provide a histogram of PCs
   bool log;
   remote_bitbang_t* remote_bitbang;
 
+  // state for running harts in parallel
+  bool parallel;
+  std::vector<std::thread> hart_threads;
+  std::mutex hart_mutex;
+  std::condition_variable hart_start;
+  std::condition_variable hart_done;
+  uint64_t hart_epoch;
+  size_t hart_quantum;
+  size_t harts_running;
+  bool harts_exit;
+  std::mutex mmio_lock;
+  void hart_thread_main(size_t i);
+  void step_parallel(size_t n);
+
   // memory-mapped I/O routines
-  char* addr_to_mem(reg_t addr);
-  bool mmio_load(reg_t addr, size_t len, uint8_t* bytes);
-  bool mmio_store(reg_t addr, size_t len, const uint8_t* bytes);
+  char* addr_to_mem(reg_t addr, size_t* hint = NULL);
+  bool mmio_load(reg_t addr, size_t len, uint8_t* bytes, size_t* hint = NULL);
+  bool mmio_store(reg_t addr, size_t len, const uint8_t* bytes, size_t* hint = NULL);
   void make_dtb();
   void set_rom();
 
   const char* get_symbol(uint64_t addr);
+  const char* get_function(uint64_t addr);
 
   // presents a prompt for introspection into the simulation
   void interactive();
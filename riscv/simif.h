@@ -9,15 +9,19 @@
 class simif_t
 {
 public:
-  // should return NULL for MMIO addresses
-  virtual char* addr_to_mem(reg_t addr) = 0;
+  // should return NULL for MMIO addresses.  a caller that looks up many
+  // addresses (e.g. a hart) may pass a hint, which caches where the
+  // previous lookup found its address.
+  virtual char* addr_to_mem(reg_t addr, size_t* hint = NULL) = 0;
   // used for MMIO addresses
-  virtual bool mmio_load(reg_t addr, size_t len, uint8_t* bytes) = 0;
-  virtual bool mmio_store(reg_t addr, size_t len, const uint8_t* bytes) = 0;
+  virtual bool mmio_load(reg_t addr, size_t len, uint8_t* bytes, size_t* hint = NULL) = 0;
+  virtual bool mmio_store(reg_t addr, size_t len, const uint8_t* bytes, size_t* hint = NULL) = 0;
   // Callback for processors to let the simulation know they were reset.
   virtual void proc_reset(unsigned id) = 0;
 
   virtual const char* get_symbol(uint64_t addr) = 0;
+  // the function of the loaded program that addr lies in, or NULL
+  virtual const char* get_function(uint64_t addr) = 0;
 
 };
 
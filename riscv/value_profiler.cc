@@ -0,0 +1,334 @@
+// See LICENSE for license details.
+
+#include "value_profiler.h"
+#include "processor.h"
+#include "disasm.h"
+#include <errno.h>
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+
+static const char* const operand_names[] = {
+  "rs1", "rs2", "imm", "rd", "mem"
+};
+
+// the index of the width bucket v falls in: 0 for 1 bit up to 6 for 64 bits
+static size_t width_index(int64_t v)
+{
+  unsigned bits = 64 - __builtin_clrsbll(v);
+  return bits <= 1 ? 0 : 64 - __builtin_clzll(bits - 1);
+}
+
+// v as a signed number of the given size in bytes
+static int64_t sext_bytes(reg_t v, unsigned bytes)
+{
+  unsigned shift = 64 - 8 * bytes;
+  return int64_t(v << shift) >> shift;
+}
+
+value_profiler_t::value_profiler_t(processor_t* proc, const char* path)
+  : proc(proc), id_cache(ID_CACHE_SIZE), id(0), ops(), rs1_value(0), rs2_value(0)
+{
+  file = fopen(path, "w");
+  if (!file) {
+    fprintf(stderr, "could not open value profile %s: %s\n", path, strerror(errno));
+    exit(1);
+  }
+
+  // no encoding is all ones, so this marks the cache entries as empty
+  for (auto& entry : id_cache)
+    entry.bits = insn_bits_t(-1);
+}
+
+value_profiler_t::~value_profiler_t()
+{
+  write_csv();
+  fclose(file);
+}
+
+uint32_t value_profiler_t::lookup(insn_t insn)
+{
+  id_cache_entry_t& entry = id_cache[insn.bits() % ID_CACHE_SIZE];
+  if (entry.bits != insn.bits()) {
+    entry.bits = insn.bits();
+    entry.id = proc->get_insn_id(insn);
+  }
+
+  if (entry.id >= executed.size()) {
+    executed.resize(entry.id + 1);
+    encodings.resize(entry.id + 1);
+    widths.resize((entry.id + 1) * OPERANDS * WIDTHS);
+  }
+  return entry.id;
+}
+
+// take insn apart by its format
+void value_profiler_t::decode(insn_t insn, unsigned xlen, operands_t& ops)
+{
+  insn_bits_t bits = insn.bits();
+  ops = operands_t();
+
+  auto set = [&](unsigned rs1, unsigned rs2, unsigned rd) {
+    ops.rs1 = rs1;
+    ops.rs2 = rs2;
+    ops.rd = rd;
+  };
+  auto set_imm = [&](int64_t imm) {
+    ops.has_imm = true;
+    ops.imm = imm;
+  };
+  auto set_mem = [&](operands_t::mem_t kind, unsigned bytes) {
+    ops.mem = kind;
+    ops.mem_bytes = bytes;
+  };
+
+  if (insn.length() == 4) {
+    unsigned funct3 = (bits >> 12) & 7;
+    switch (bits & 0x7f) {
+      case 0x03: // LOAD
+        set(insn.rs1(), 0, insn.rd());
+        set_imm(insn.i_imm());
+        set_mem(operands_t::LOAD, 1 << (funct3 & 3));
+        break;
+      case 0x13: // OP-IMM
+      case 0x1b: // OP-IMM-32
+        set(insn.rs1(), 0, insn.rd());
+        set_imm((funct3 & 3) == 1 ? insn.shamt() : insn.i_imm());
+        break;
+      case 0x17: // AUIPC
+      case 0x37: // LUI
+        set(0, 0, insn.rd());
+        set_imm(insn.u_imm());
+        break;
+      case 0x23: // STORE
+        set(insn.rs1(), insn.rs2(), 0);
+        set_imm(insn.s_imm());
+        set_mem(operands_t::STORE, 1 << (funct3 & 3));
+        break;
+      case 0x2f: // AMO; lr has no rs2
+        set(insn.rs1(), (bits >> 27) == 2 ? 0 : insn.rs2(), insn.rd());
+        set_mem(operands_t::LOAD, 1 << (funct3 & 3));
+        break;
+      case 0x33: // OP
+      case 0x3b: // OP-32
+        set(insn.rs1(), insn.rs2(), insn.rd());
+        break;
+      case 0x63: // BRANCH
+        set(insn.rs1(), insn.rs2(), 0);
+        set_imm(insn.sb_imm());
+        break;
+      case 0x67: // JALR
+        set(insn.rs1(), 0, insn.rd());
+        set_imm(insn.i_imm());
+        break;
+      case 0x6f: // JAL
+        set(0, 0, insn.rd());
+        set_imm(insn.uj_imm());
+        break;
+      case 0x73: // SYSTEM: the CSR instructions
+        if (funct3 >= 1 && funct3 <= 3) {
+          set(insn.rs1(), 0, insn.rd());
+        } else if (funct3 >= 5) {
+          set(0, 0, insn.rd());
+          set_imm(insn.rs1());
+        }
+        break;
+    }
+    return;
+  }
+
+  if (insn.length() != 2)
+    return;
+
+  bool rv64 = xlen == 64;
+  unsigned rs1s = insn.rvc_rs1s(), rs2s = insn.rvc_rs2s();
+  unsigned rd = insn.rvc_rd(), rs2 = insn.rvc_rs2();
+  switch (bits & 0xe003) {
+    case 0x0000: // c.addi4spn
+      set(2, 0, rs2s);
+      set_imm(insn.rvc_addi4spn_imm());
+      break;
+    case 0x2000: // c.fld
+    case 0xa000: // c.fsd
+      set(rs1s, 0, 0);
+      set_imm(insn.rvc_ld_imm());
+      break;
+    case 0x4000: // c.lw
+      set(rs1s, 0, rs2s);
+      set_imm(insn.rvc_lw_imm());
+      set_mem(operands_t::LOAD, 4);
+      break;
+    case 0x6000: // c.ld, or c.flw on RV32
+      set(rs1s, 0, rv64 ? rs2s : 0);
+      set_imm(rv64 ? insn.rvc_ld_imm() : insn.rvc_lw_imm());
+      if (rv64)
+        set_mem(operands_t::LOAD, 8);
+      break;
+    case 0xc000: // c.sw
+      set(rs1s, rs2s, 0);
+      set_imm(insn.rvc_lw_imm());
+      set_mem(operands_t::STORE, 4);
+      break;
+    case 0xe000: // c.sd, or c.fsw on RV32
+      set(rs1s, rv64 ? rs2s : 0, 0);
+      set_imm(rv64 ? insn.rvc_ld_imm() : insn.rvc_lw_imm());
+      if (rv64)
+        set_mem(operands_t::STORE, 8);
+      break;
+    case 0x0001: // c.addi
+    case 0x4001: // c.li
+      set(bits & 0x4000 ? 0 : rd, 0, rd);
+      set_imm(insn.rvc_imm());
+      break;
+    case 0x2001: // c.addiw, or c.jal on RV32
+      if (rv64)
+        set(rd, 0, rd);
+      else
+        set(0, 0, 1);
+      set_imm(rv64 ? insn.rvc_imm() : insn.rvc_j_imm());
+      break;
+    case 0x6001: // c.addi16sp, or c.lui
+      if (rd == 2) {
+        set(2, 0, 2);
+        set_imm(insn.rvc_addi16sp_imm());
+      } else {
+        set(0, 0, rd);
+        set_imm(insn.rvc_imm() << 12);
+      }
+      break;
+    case 0x8001: // the compressed arithmetic on rs1'
+      switch ((bits >> 10) & 3) {
+        case 0: // c.srli
+        case 1: // c.srai
+          set(rs1s, 0, rs1s);
+          set_imm(insn.rvc_zimm());
+          break;
+        case 2: // c.andi
+          set(rs1s, 0, rs1s);
+          set_imm(insn.rvc_imm());
+          break;
+        case 3: // c.sub to c.addw, and the unary ones of Zcb
+          if ((bits & 0x1000) && ((bits >> 5) & 3) == 3)
+            set(rs1s, 0, rs1s);
+          else
+            set(rs1s, rs2s, rs1s);
+          break;
+      }
+      break;
+    case 0xa001: // c.j
+      set_imm(insn.rvc_j_imm());
+      break;
+    case 0xc001: // c.beqz
+    case 0xe001: // c.bnez
+      set(rs1s, 0, 0);
+      set_imm(insn.rvc_b_imm());
+      break;
+    case 0x0002: // c.slli
+      set(rd, 0, rd);
+      set_imm(insn.rvc_zimm());
+      break;
+    case 0x2002: // c.fldsp
+      set(2, 0, 0);
+      set_imm(insn.rvc_ldsp_imm());
+      break;
+    case 0x4002: // c.lwsp
+      set(2, 0, rd);
+      set_imm(insn.rvc_lwsp_imm());
+      set_mem(operands_t::LOAD, 4);
+      break;
+    case 0x6002: // c.ldsp, or c.flwsp on RV32
+      set(2, 0, rv64 ? rd : 0);
+      set_imm(rv64 ? insn.rvc_ldsp_imm() : insn.rvc_lwsp_imm());
+      if (rv64)
+        set_mem(operands_t::LOAD, 8);
+      break;
+    case 0x8002: // c.jr, c.mv, c.ebreak, c.jalr and c.add
+      if (!(bits & 0x1000))
+        set(rs2 ? 0 : rd, rs2, rs2 ? rd : 0);
+      else if (rs2)
+        set(rd, rs2, rd);
+      else if (rd)
+        set(rd, 0, 1);
+      break;
+    case 0xa002: // c.fsdsp
+      set(2, 0, 0);
+      set_imm(insn.rvc_sdsp_imm());
+      break;
+    case 0xc002: // c.swsp
+      set(2, rs2, 0);
+      set_imm(insn.rvc_swsp_imm());
+      set_mem(operands_t::STORE, 4);
+      break;
+    case 0xe002: // c.sdsp, or c.fswsp on RV32
+      set(2, rv64 ? rs2 : 0, 0);
+      set_imm(rv64 ? insn.rvc_sdsp_imm() : insn.rvc_swsp_imm());
+      if (rv64)
+        set_mem(operands_t::STORE, 8);
+      break;
+  }
+}
+
+void value_profiler_t::issue(processor_t* p, reg_t pc, insn_t insn)
+{
+  id = lookup(insn);
+  decode(insn, p->get_xlen(), ops);
+
+  // the sources must be read now, as the instruction may overwrite them
+  rs1_value = p->get_state()->XPR[ops.rs1];
+  rs2_value = p->get_state()->XPR[ops.rs2];
+}
+
+void value_profiler_t::retire(processor_t* p, reg_t pc, insn_t insn, reg_t npc)
+{
+  if (executed[id]++ == 0)
+    encodings[id] = insn.bits();
+
+  reg_t rd_value = p->get_state()->XPR[ops.rd];
+  if (ops.rs1)
+    histogram(id, SRC1)[width_index(rs1_value)]++;
+  if (ops.rs2)
+    histogram(id, SRC2)[width_index(rs2_value)]++;
+  if (ops.has_imm)
+    histogram(id, IMM)[width_index(ops.imm)]++;
+  if (ops.rd)
+    histogram(id, DEST)[width_index(rd_value)]++;
+
+  // a load to x0 leaves no trace of the value it read
+  if (ops.mem == operands_t::STORE)
+    histogram(id, MEM)[width_index(sext_bytes(rs2_value, ops.mem_bytes))]++;
+  else if (ops.mem == operands_t::LOAD && ops.rd)
+    histogram(id, MEM)[width_index(sext_bytes(rd_value, ops.mem_bytes))]++;
+}
+
+void value_profiler_t::write_csv()
+{
+  std::vector<uint32_t> ids;
+  for (uint32_t i = 0; i < executed.size(); i++)
+    if (executed[i])
+      ids.push_back(i);
+  std::sort(ids.begin(), ids.end(), [this](uint32_t a, uint32_t b) {
+    return executed[a] != executed[b] ? executed[a] > executed[b] : a < b;
+  });
+
+  fprintf(file, "insn,executed,operand,w1,w2,w4,w8,w16,w32,w64\n");
+  for (auto i : ids) {
+    const disasm_insn_t* disasm = proc->get_disassembler()->lookup(encodings[i]);
+    const char* name = disasm ? disasm->get_name() : "unknown";
+    bool any = false;
+    for (size_t operand = 0; operand < OPERANDS; operand++) {
+      const uint64_t* counts = histogram(i, operand_t(operand));
+      if (std::all_of(counts, counts + WIDTHS, [](uint64_t n) { return n == 0; }))
+        continue;
+      fprintf(file, "%s,%" PRIu64 ",%s", name, executed[i], operand_names[operand]);
+      for (size_t w = 0; w < WIDTHS; w++)
+        fprintf(file, ",%" PRIu64, counts[w]);
+      fprintf(file, "\n");
+      any = true;
+    }
+
+    // still count the instructions with no integer operands
+    if (!any)
+      fprintf(file, "%s,%" PRIu64 ",,0,0,0,0,0,0,0\n", name, executed[i]);
+  }
+}
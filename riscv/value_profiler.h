@@ -0,0 +1,75 @@
+// See LICENSE for license details.
+
+#ifndef _RISCV_VALUE_PROFILER_H
+#define _RISCV_VALUE_PROFILER_H
+
+#include "profiler.h"
+#include <stdio.h>
+#include <vector>
+
+// Histograms the widths of the integer values each opcode works on, for
+// narrow-datapath studies: its source registers, its immediate, the register
+// it writes and the value it loads or stores.  A value's width is the number
+// of bits it needs as a two's complement number, rounded up to 1, 2, 4, 8,
+// 16, 32 or 64.  The counts live in one flat array indexed by the compact
+// instruction id the hart assigns when it registers its instructions (see
+// processor_t::register_insn()), and are written out as CSV when the
+// profiler is destroyed, most executed opcode first.
+//
+// Only the base integer and compressed instructions are taken apart; others
+// are counted, but their operands are not.
+class value_profiler_t : public insn_profiler_t
+{
+ public:
+  enum operand_t { SRC1, SRC2, IMM, DEST, MEM, OPERANDS };
+  static const size_t WIDTHS = 7;
+
+  // open path, exiting with an error message on failure
+  value_profiler_t(processor_t* proc, const char* path);
+  ~value_profiler_t();
+
+  void issue(processor_t* p, reg_t pc, insn_t insn);
+  void retire(processor_t* p, reg_t pc, insn_t insn, reg_t npc);
+
+ private:
+  // the integer operands of an instruction
+  struct operands_t {
+    enum mem_t { NONE, LOAD, STORE };
+
+    uint8_t rs1, rs2, rd; // 0 if not used
+    bool has_imm;
+    int64_t imm;
+    mem_t mem;
+    unsigned mem_bytes;
+  };
+
+  // id_cache maps encodings to instruction ids, so that a retired
+  // instruction seldom has to be decoded again
+  static const size_t ID_CACHE_SIZE = 4096;
+  struct id_cache_entry_t {
+    insn_bits_t bits;
+    uint32_t id;
+  };
+
+  processor_t* proc;
+  FILE* file;
+  std::vector<id_cache_entry_t> id_cache;
+  std::vector<uint64_t> executed; // by instruction id
+  std::vector<insn_bits_t> encodings; // an encoding of each instruction
+  std::vector<uint64_t> widths; // by instruction id, operand_t and width
+
+  // the instruction being executed
+  uint32_t id;
+  operands_t ops;
+  reg_t rs1_value, rs2_value;
+
+  static void decode(insn_t insn, unsigned xlen, operands_t& ops);
+  uint32_t lookup(insn_t insn);
+  uint64_t* histogram(uint32_t id, operand_t operand)
+  {
+    return &widths[(id * OPERANDS + operand) * WIDTHS];
+  }
+  void write_csv();
+};
+
+#endif
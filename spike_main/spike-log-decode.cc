@@ -0,0 +1,27 @@
+// See LICENSE for license details.
+
+// This little program converts a binary commit log, as written by
+//   spike --log-commits-binary=<file>
+// back to the text that --log-commits writes.  It reads the named file, or
+// its standard input if there is none, and writes to its standard output.
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include "commit_log.h"
+
+int main(int argc, char** argv)
+{
+  if (argc > 2) {
+    fprintf(stderr, "usage: %s [binary commit log]\n", argv[0]);
+    return 1;
+  }
+
+  FILE* in = stdin;
+  if (argc == 2 && !(in = fopen(argv[1], "rb"))) {
+    fprintf(stderr, "could not open %s: %s\n", argv[1], strerror(errno));
+    return 1;
+  }
+
+  return commit_log_decode(in, stdout) ? 0 : 1;
+}
@@ -5,11 +5,16 @@
 #include "mmu.h"
 #include "remote_bitbang.h"
 #include "cachesim.h"
+#include "branch_stats.h"
+#include "branch_profiler.h"
+#include "value_profiler.h"
+#include "sample_profiler.h"
 #include "extension.h"
 #include <dlfcn.h>
 #include <fesvr/option_parser.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <vector>
 #include <string>
 #include <memory>
@@ -25,8 +30,10 @@ static void help(int exit_code = 1)
   fprintf(stderr, "  -m<n>                 Provide <n> MiB of target memory [default 2048]\n");
   fprintf(stderr, "  -m<a:m,b:n,...>       Provide memory regions of size m and n bytes\n");
   fprintf(stderr, "                          at base addresses a and b (with 4 KiB alignment)\n");
+  fprintf(stderr, "  --flat-mem            Reserve each memory region in one piece of host\n");
+  fprintf(stderr, "                          memory, populated as it is touched\n");
   fprintf(stderr, "  -d                    Interactive debug mode\n");
-  fprintf(stderr, "  -g                    Track histogram of PCs\n");
+  fprintf(stderr, "  -g                    Track histogram of PCs, printed most frequent first\n");
   fprintf(stderr, "  -l                    Generate a log of execution\n");
 #ifdef HAVE_BOOST_ASIO
   fprintf(stderr, "  -s                    Command I/O via socket (use with -d)\n");
@@ -34,6 +41,9 @@ static void help(int exit_code = 1)
   fprintf(stderr, "  -h, --help            Print this help message\n");
   fprintf(stderr, "  -H                    Start halted, allowing a debugger to connect\n");
   fprintf(stderr, "  --log=<name>          File name for option -l\n");
+  fprintf(stderr, "  --log-commits-binary=<name>\n");
+  fprintf(stderr, "                        Write the commit log to file <name> in binary form;\n");
+  fprintf(stderr, "                          spike-log-decode turns it back into text\n");
   fprintf(stderr, "  --debug-cmd=<name>    Read commands from file (use with -d)\n");
   fprintf(stderr, "  --isa=<name>          RISC-V ISA string [default %s]\n", DEFAULT_ISA);
   fprintf(stderr, "  --priv=<m|mu|msu>     RISC-V privilege modes supported [default %s]\n", DEFAULT_PRIV);
@@ -43,6 +53,28 @@ static void help(int exit_code = 1)
   fprintf(stderr, "  --ic=<S>:<W>:<B>      Instantiate a cache model with S sets,\n");
   fprintf(stderr, "  --dc=<S>:<W>:<B>        W ways, and B-byte blocks (with S and\n");
   fprintf(stderr, "  --l2=<S>:<W>:<B>        B both powers of 2).\n");
+  fprintf(stderr, "  --tlb=<S>:<W>         Simulator TLB with S sets and W ways, both powers\n");
+  fprintf(stderr, "                          of 2 [default 256:4]\n");
+  fprintf(stderr, "  --tlb-stats           Print simulator TLB statistics on exit\n");
+  fprintf(stderr, "  --decode-stats        Print instruction decode cache statistics on exit\n");
+  fprintf(stderr, "  --insn-mix            Print how often each instruction was executed on exit\n");
+  fprintf(stderr, "  --insn-mix-by-priv    Like --insn-mix, and split the counts by privilege mode\n");
+  fprintf(stderr, "  --branch-stats        Print how often each kind of branch was taken on exit\n");
+  fprintf(stderr, "  --branch-profile=<file>\n");
+  fprintf(stderr, "                        Write per-site branch statistics to file on exit\n");
+  fprintf(stderr, "                          (file.<n> for processor n if there are several)\n");
+  fprintf(stderr, "  --branch-profile-format=<csv|binary>\n");
+  fprintf(stderr, "                        Format of --branch-profile [default csv]\n");
+  fprintf(stderr, "  --value-profile=<file>\n");
+  fprintf(stderr, "                        Write the widths of each opcode's operands to file on exit\n");
+  fprintf(stderr, "                          (file.<n> for processor n if there are several)\n");
+  fprintf(stderr, "  --sample-profile=<file>\n");
+  fprintf(stderr, "                        Sample the running functions, print a flat profile on exit\n");
+  fprintf(stderr, "                          and write their call stacks to file for flame graphs\n");
+  fprintf(stderr, "  --sample-interval=<n> Instructions per --sample-profile sample [default 10000]\n");
+  fprintf(stderr, "  --bbv=<file>          Write SimPoint basic-block vectors to file\n");
+  fprintf(stderr, "                          (file.<n> for processor n if there are several)\n");
+  fprintf(stderr, "  --bbv-interval=<n>    Instructions per basic-block vector [default 100000000]\n");
   fprintf(stderr, "  --device=<P,B,A>      Attach MMIO plugin device from an --extlib library\n");
   fprintf(stderr, "                          P -- Name of the MMIO plugin\n");
   fprintf(stderr, "                          B -- Base memory address of the device\n");
@@ -50,6 +82,20 @@ static void help(int exit_code = 1)
   fprintf(stderr, "                          This flag can be used multiple times.\n");
   fprintf(stderr, "                          The extlib flag for the library must come first.\n");
   fprintf(stderr, "  --log-cache-miss      Generate a log of cache miss\n");
+  fprintf(stderr, "  --jit                 Translate hot RV64I/M code to native x86-64 code\n");
+  fprintf(stderr, "  --parallel            Run each processor on its own host thread\n");
+  fprintf(stderr, "                          (faster, but not deterministic)\n");
+  fprintf(stderr, "  --checkpoint-save=<file>@<n>\n");
+  fprintf(stderr, "                        Save the machine to file when processor 0 has\n");
+  fprintf(stderr, "                          retired n instructions, and keep running\n");
+  fprintf(stderr, "  --checkpoint-restore=<file>\n");
+  fprintf(stderr, "                        Resume from a checkpoint saved with the same options\n");
+  fprintf(stderr, "  --fork=<options>      Fork a child process that goes on with the cache\n");
+  fprintf(stderr, "                          options (--ic, --dc, --l2) in <options>, when\n");
+  fprintf(stderr, "                          processor 0 reaches --fork-at or the program\n");
+  fprintf(stderr, "                          writes CSR 0x8ff, which reads as the child's number.\n");
+  fprintf(stderr, "                          This flag can be used multiple times.\n");
+  fprintf(stderr, "  --fork-at=<n>         Fork when processor 0 has retired n instructions\n");
   fprintf(stderr, "  --extension=<name>    Specify RoCC Extension\n");
   fprintf(stderr, "                          This flag can be used multiple times.\n");
   fprintf(stderr, "  --extlib=<name>       Shared library to load\n");
@@ -194,12 +240,12 @@ static std::vector<mem_cfg_t> parse_mem_layout(const char* arg)
   return res;
 }
 
-static std::vector<std::pair<reg_t, mem_t*>> make_mems(const std::vector<mem_cfg_t> &layout)
+static std::vector<std::pair<reg_t, mem_t*>> make_mems(const std::vector<mem_cfg_t> &layout, bool flat)
 {
   std::vector<std::pair<reg_t, mem_t*>> mems;
   mems.reserve(layout.size());
   for (const auto &cfg : layout) {
-    mems.push_back(std::make_pair(cfg.base, new mem_t(cfg.size)));
+    mems.push_back(std::make_pair(cfg.base, new mem_t(cfg.size, flat)));
   }
   return mems;
 }
@@ -241,6 +287,9 @@ int main(int argc, char** argv)
   bool debug = false;
   bool halted = false;
   bool histogram = false;
+  bool jit = false;
+  bool parallel = false;
+  bool flat_mem = false;
   bool log = false;
   bool socket = false;  // command line option -s
   bool dump_dts = false;
@@ -252,8 +301,30 @@ int main(int argc, char** argv)
   std::unique_ptr<dcache_sim_t> dc;
   std::unique_ptr<cache_sim_t> l2;
   bool log_cache = false;
+  size_t tlb_sets = 0, tlb_ways = 0;
+  bool tlb_stats = false;
+  bool decode_stats = false;
+  bool insn_mix = false;
+  bool insn_mix_by_priv = false;
+  bool branch_stats = false;
+  const char* branch_profile_path = NULL;
+  bool branch_profile_binary = false;
+  const char* value_profile_path = NULL;
+  const char* sample_profile_path = NULL;
+  reg_t sample_interval = 10000;
+  const char* bbv_path = NULL;
+  reg_t bbv_interval = 100000000;
+  std::string checkpoint_save;
+  reg_t checkpoint_save_instret = 0;
+  const char* checkpoint_restore = NULL;
+  struct fork_config_t {
+    std::string ic, dc, l2;
+  };
+  std::vector<fork_config_t> fork_configs;
+  reg_t fork_at = -1;
   bool log_commits = false;
   const char *log_path = nullptr;
+  const char *log_commits_binary_path = nullptr;
   std::vector<std::function<extension_t*()>> extensions;
   const char* initrd = NULL;
   const char* dtb_file = NULL;
@@ -336,6 +407,7 @@ int main(int argc, char** argv)
 #endif
   parser.option('p', 0, 1, [&](const char* s){nprocs = atoul_nonzero_safe(s);});
   parser.option('m', 0, 1, [&](const char* s){cfg.mem_layout = parse_mem_layout(s);});
+  parser.option(0, "flat-mem", 0, [&](const char* s){flat_mem = true;});
   // I wanted to use --halted, but for some reason that doesn't work.
   parser.option('H', 0, 0, [&](const char* s){halted = true;});
   parser.option(0, "rbb-port", 1, [&](const char* s){use_rbb = true; rbb_port = atoul_safe(s);});
@@ -348,6 +420,34 @@ int main(int argc, char** argv)
   parser.option(0, "dc", 1, [&](const char* s){dc.reset(new dcache_sim_t(s));});
   parser.option(0, "l2", 1, [&](const char* s){l2.reset(cache_sim_t::construct(s, "L2$"));});
   parser.option(0, "log-cache-miss", 0, [&](const char* s){log_cache = true;});
+  parser.option(0, "tlb", 1, [&](const char* s){
+    char* ways;
+    tlb_sets = strtoull(s, &ways, 0);
+    tlb_ways = *ways == ':' ? strtoull(ways + 1, 0, 0) : 0;
+    if (tlb_sets == 0 || (tlb_sets & (tlb_sets - 1)) != 0 ||
+        tlb_ways == 0 || (tlb_ways & (tlb_ways - 1)) != 0) {
+      fprintf(stderr, "--tlb should be <sets>:<ways>, both powers of 2\n");
+      exit(-1);
+    }
+  });
+  parser.option(0, "tlb-stats", 0, [&](const char* s){tlb_stats = true;});
+  parser.option(0, "decode-stats", 0, [&](const char* s){decode_stats = true;});
+  parser.option(0, "insn-mix", 0, [&](const char* s){insn_mix = true;});
+  parser.option(0, "insn-mix-by-priv", 0, [&](const char* s){insn_mix = insn_mix_by_priv = true;});
+  parser.option(0, "branch-stats", 0, [&](const char* s){branch_stats = true;});
+  parser.option(0, "branch-profile", 1, [&](const char* s){branch_profile_path = s;});
+  parser.option(0, "branch-profile-format", 1, [&](const char* s){
+    if (strcmp(s, "csv") != 0 && strcmp(s, "binary") != 0) {
+      fprintf(stderr, "--branch-profile-format must be csv or binary\n");
+      exit(-1);
+    }
+    branch_profile_binary = strcmp(s, "binary") == 0;
+  });
+  parser.option(0, "value-profile", 1, [&](const char* s){value_profile_path = s;});
+  parser.option(0, "sample-profile", 1, [&](const char* s){sample_profile_path = s;});
+  parser.option(0, "sample-interval", 1, [&](const char* s){sample_interval = atoul_nonzero_safe(s);});
+  parser.option(0, "bbv", 1, [&](const char* s){bbv_path = s;});
+  parser.option(0, "bbv-interval", 1, [&](const char* s){bbv_interval = atoul_nonzero_safe(s);});
   parser.option(0, "isa", 1, [&](const char* s){cfg.isa = s;});
   parser.option(0, "priv", 1, [&](const char* s){cfg.priv = s;});
   parser.option(0, "varch", 1, [&](const char* s){cfg.varch = s;});
@@ -385,10 +485,47 @@ int main(int argc, char** argv)
       [&](const char* s){dm_config.support_abstract_csr_access = false;});
   parser.option(0, "dm-no-halt-groups", 0,
       [&](const char* s){dm_config.support_haltgroups = false;});
+  parser.option(0, "jit", 0, [&](const char* s){jit = true;});
+  parser.option(0, "parallel", 0, [&](const char* s){parallel = true;});
+  parser.option(0, "checkpoint-save", 1, [&](const char* s){
+    const char* at = strrchr(s, '@');
+    char* end = NULL;
+    if (at)
+      checkpoint_save_instret = strtoull(at + 1, &end, 0);
+    if (!at || at == s || end == at + 1 || *end) {
+      fprintf(stderr, "--checkpoint-save should be <file>@<instructions>\n");
+      exit(-1);
+    }
+    checkpoint_save = std::string(s, at);
+  });
+  parser.option(0, "checkpoint-restore", 1, [&](const char* s){checkpoint_restore = s;});
+  parser.option(0, "fork", 1, [&](const char* s){
+    fork_config_t config;
+    std::istringstream stream(s);
+    std::string option;
+    while (stream >> option) {
+      if (option.compare(0, 5, "--ic=") == 0)
+        config.ic = option.substr(5);
+      else if (option.compare(0, 5, "--dc=") == 0)
+        config.dc = option.substr(5);
+      else if (option.compare(0, 5, "--l2=") == 0)
+        config.l2 = option.substr(5);
+      else {
+        fprintf(stderr, "--fork only takes --ic, --dc and --l2 options, not %s\n", option.c_str());
+        exit(-1);
+      }
+    }
+    fork_configs.push_back(config);
+  });
+  parser.option(0, "fork-at", 1, [&](const char* s){fork_at = strtoull(s, 0, 0);});
   parser.option(0, "log-commits", 0,
                 [&](const char* s){log_commits = true;});
   parser.option(0, "log", 1,
                 [&](const char* s){log_path = s;});
+  parser.option(0, "log-commits-binary", 1, [&](const char* s){
+    log_commits_binary_path = s;
+    log_commits = true;
+  });
   FILE *cmd_file = NULL;
   parser.option(0, "debug-cmd", 1, [&](const char* s){
      if ((cmd_file = fopen(s, "r"))==NULL) {
@@ -410,7 +547,18 @@ int main(int argc, char** argv)
   if (!*argv1)
     help();
 
-  std::vector<std::pair<reg_t, mem_t*>> mems = make_mems(cfg.mem_layout());
+  if (parallel && (!checkpoint_save.empty() || checkpoint_restore || !fork_configs.empty())) {
+    fprintf(stderr, "--parallel cannot be combined with checkpoints or --fork\n");
+    exit(-1);
+  }
+
+  // the children of a fork would lose the thread that writes the log
+  if (log_commits_binary_path && !fork_configs.empty()) {
+    fprintf(stderr, "--log-commits-binary cannot be combined with --fork\n");
+    exit(-1);
+  }
+
+  std::vector<std::pair<reg_t, mem_t*>> mems = make_mems(cfg.mem_layout(), flat_mem);
 
   if (kernel && check_file_exists(kernel)) {
     const char *isa = cfg.isa();
@@ -506,6 +654,12 @@ int main(int argc, char** argv)
   if (dc && l2) dc->set_miss_handler(&*l2);
   if (ic) ic->set_log(log_cache);
   if (dc) dc->set_log(log_cache);
+  std::vector<std::unique_ptr<branch_stats_t>> branch_counts;
+  std::vector<std::unique_ptr<branch_profiler_t>> branch_sites;
+  std::vector<std::unique_ptr<value_profiler_t>> value_profilers;
+  std::unique_ptr<sample_profiler_t> sample_profiler;
+  if (sample_profile_path)
+    sample_profiler.reset(new sample_profiler_t(&s, sample_profile_path, sample_interval, cfg.nprocs()));
   for (size_t i = 0; i < cfg.nprocs(); i++)
   {
     if (ic) s.get_core(i)->get_mmu()->register_memtracer(&*ic);
@@ -513,14 +667,92 @@ int main(int argc, char** argv)
     for (auto e : extensions)
       s.get_core(i)->register_extension(e());
     s.get_core(i)->get_mmu()->set_cache_blocksz(blocksz);
+    if (branch_stats) {
+      branch_counts.emplace_back(new branch_stats_t(s.get_core(i)->get_id()));
+      s.get_core(i)->register_profiler(branch_counts.back().get());
+    }
+    if (branch_profile_path) {
+      std::string path = branch_profile_path;
+      if (cfg.nprocs() > 1)
+        path += "." + std::to_string(i);
+      branch_sites.emplace_back(new branch_profiler_t(s.get_core(i), path.c_str(), branch_profile_binary));
+      s.get_core(i)->register_profiler(branch_sites.back().get());
+    }
+    if (value_profile_path) {
+      std::string path = value_profile_path;
+      if (cfg.nprocs() > 1)
+        path += "." + std::to_string(i);
+      value_profilers.emplace_back(new value_profiler_t(s.get_core(i), path.c_str()));
+      s.get_core(i)->register_profiler(value_profilers.back().get());
+    }
+    if (sample_profiler)
+      s.get_core(i)->set_sampler(sample_profiler->get_hart(i));
+    if (tlb_sets)
+      s.get_core(i)->get_mmu()->set_tlb_size(tlb_sets, tlb_ways);
   }
 
   s.set_debug(debug);
   s.configure_log(log, log_commits);
+  if (log_commits_binary_path)
+    s.set_commit_log_binary(log_commits_binary_path);
   s.set_histogram(histogram);
+  if (insn_mix)
+    s.set_insn_mix(insn_mix_by_priv);
+  s.set_jit(jit);
+  if (bbv_path)
+    s.set_bbv(bbv_path, bbv_interval);
+  s.set_parallel(parallel);
+  if (!checkpoint_save.empty())
+    s.set_checkpoint_save(checkpoint_save.c_str(), checkpoint_save_instret);
+  if (checkpoint_restore)
+    s.set_checkpoint_restore(checkpoint_restore);
+
+  // a child replaces the cache models its options name, and the others keep
+  // what they learned before the fork.  the replaced models are dropped
+  // without printing their statistics, which every child would repeat.
+  auto setup_fork_child = [&](size_t child) {
+    const fork_config_t& config = fork_configs[child - 1];
+    for (size_t i = 0; i < cfg.nprocs(); i++) {
+      if (ic && !config.ic.empty()) s.get_core(i)->get_mmu()->unregister_memtracer(&*ic);
+      if (dc && !config.dc.empty()) s.get_core(i)->get_mmu()->unregister_memtracer(&*dc);
+    }
+    if (!config.ic.empty()) ic.release();
+    if (!config.dc.empty()) dc.release();
+    if (!config.l2.empty()) l2.release();
+    if (!config.ic.empty()) ic.reset(new icache_sim_t(config.ic.c_str()));
+    if (!config.dc.empty()) dc.reset(new dcache_sim_t(config.dc.c_str()));
+    if (!config.l2.empty()) l2.reset(cache_sim_t::construct(config.l2.c_str(), "L2$"));
+    if (ic && l2) ic->set_miss_handler(&*l2);
+    if (dc && l2) dc->set_miss_handler(&*l2);
+    if (ic) ic->set_log(log_cache);
+    if (dc) dc->set_log(log_cache);
+    for (size_t i = 0; i < cfg.nprocs(); i++) {
+      if (!config.ic.empty()) s.get_core(i)->get_mmu()->register_memtracer(&*ic);
+      if (!config.dc.empty()) s.get_core(i)->get_mmu()->register_memtracer(&*dc);
+    }
+  };
+  if (!fork_configs.empty())
+    s.set_fork(fork_at, fork_configs.size(), setup_fork_child);
+  else if (fork_at != reg_t(-1)) {
+    fprintf(stderr, "--fork-at needs at least one --fork\n");
+    exit(-1);
+  }
 
   auto return_code = s.run();
 
+  if (tlb_stats)
+    for (size_t i = 0; i < cfg.nprocs(); i++)
+      s.get_core(i)->get_mmu()->print_tlb_stats();
+  if (decode_stats)
+    for (size_t i = 0; i < cfg.nprocs(); i++)
+      s.get_core(i)->print_decode_stats();
+  if (insn_mix)
+    for (size_t i = 0; i < cfg.nprocs(); i++)
+      s.get_core(i)->print_insn_mix();
+  for (auto& profiler : branch_counts)
+    profiler->print();
+  sample_profiler.reset();
+
   for (auto& mem : mems)
     delete mem.second;
 